@@ -0,0 +1,677 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "arena.h"
+#include "arith.h"
+#include "builtin.h"
+#include "glob.h"
+#include "io.h"
+#include "pathcache.h"
+#include "shell.h"
+#include "zygote.h"
+
+/*
+  Benchmarks of the shell's hot paths, linked against the shell built
+  with -DSOSHELL_NO_MAIN.  Run by "make bench".
+
+  Each benchmark is timed over several rounds and the fastest round is
+  kept.  Results are printed as one JSON document on stdout, so runs on
+  different commits can be compared with any JSON tool; progress goes
+  to stderr.  Output of the commands under test goes to /dev/null.
+ */
+
+#define BENCH_ROUNDS 5
+#define BENCH_LS_FILES 10000
+#define BENCH_TREE_DIRS 100
+#define BENCH_TREE_FILES 1000  /* per directory */
+#define BENCH_SPAWNS 500
+#define BENCH_PIPELINES 200
+#define BENCH_HEAP (1024L * 1024 * 1024)
+#define BENCH_DATA (256L * 1024 * 1024)
+#define BENCH_CP_ROUNDS 3
+
+struct bench_result {
+  const char *name;
+  long ops;                /* operations per round */
+  double ns_per_op;        /* fastest round */
+  double p50;              /* per-operation percentiles, if sampled */
+  double p99;
+  double bytes_per_op;     /* 0 when not a throughput benchmark */
+};
+
+static struct bench_result bench_results[32];
+static int bench_nresults;
+static char bench_dir[] = "/tmp/soshell-bench.XXXXXX";
+
+static double bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+static struct bench_result *bench_add(const char *name, long ops, double best)
+{
+  struct bench_result *r = &bench_results[bench_nresults++];
+
+  memset(r, 0, sizeof(*r));
+  r->name = name;
+  r->ops = ops;
+  r->ns_per_op = best / ops;
+  fprintf(stderr, "%-20s %12.1f ns/op\n", name, r->ns_per_op);
+  return r;
+}
+
+static void bench_write_file(const char *path, const char *data, size_t len)
+{
+  FILE *f = fopen(path, "w");
+
+  if (f == NULL || fwrite(data, 1, len, f) != len || fclose(f) != 0) {
+    fprintf(stderr, "bench: %s: %s\n", path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+}
+
+/*
+  A tree of BENCH_TREE_DIRS directories of BENCH_TREE_FILES small
+  files each, half .c and half .h.  Built once, in bench_dir/tree.
+ */
+static const char *bench_tree(void)
+{
+  static char tree[64];
+  const char *line = "int bench_data[] = { 1, 2, 3, 4, 5, 6, 7, 8 };\n";
+  char path[128];
+  int i, j;
+
+  if (tree[0] != '\0') {
+    return tree;
+  }
+  snprintf(tree, sizeof(tree), "%s/tree", bench_dir);
+  mkdir(tree, 0700);
+  for (i = 0; i < BENCH_TREE_DIRS; i++) {
+    snprintf(path, sizeof(path), "%s/d%03d", tree, i);
+    mkdir(path, 0700);
+    for (j = 0; j < BENCH_TREE_FILES; j++) {
+      snprintf(path, sizeof(path), "%s/d%03d/file%04d.%c", tree, i, j, "ch"[j & 1]);
+      bench_write_file(path, line, strlen(line));
+    }
+  }
+  return tree;
+}
+
+/*
+  BENCH_DATA bytes of text lines, for the throughput benchmarks.
+  Written once, in bench_dir/data.
+ */
+static const char *bench_data(void)
+{
+  static char path[64];
+  const char *line = "2024-01-01 12:00:00 worker 7 handled request in 12 ms\n";
+  size_t len = strlen(line), fill;
+  char *block;
+  long done;
+  int fd;
+
+  if (path[0] != '\0') {
+    return path;
+  }
+  block = malloc(1024 * 1024);
+  if (!block) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  for (fill = 0; fill + len <= 1024 * 1024; fill += len) {
+    memcpy(block + fill, line, len);
+  }
+  snprintf(path, sizeof(path), "%s/data", bench_dir);
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  for (done = 0; fd >= 0 && done < BENCH_DATA; done += fill) {
+    if (write(fd, block, fill) != (ssize_t)fill) {
+      break;
+    }
+  }
+  if (fd < 0 || done < BENCH_DATA || close(fd) != 0) {
+    fprintf(stderr, "bench: %s: %s\n", path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  free(block);
+  return path;
+}
+
+/*
+  soshell_read_line() over a file of typical command lines.
+ */
+static void bench_read_line(void)
+{
+  const char *sample = "grep -n pattern src/main.c src/io.c | sort -r\n";
+  size_t len = strlen(sample), n = 200000, i;
+  char *data = malloc(len * n), path[64], *line;
+  double best = 0, t;
+  FILE *f;
+  int round;
+
+  if (!data) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < n; i++) {
+    memcpy(data + i * len, sample, len);
+  }
+  snprintf(path, sizeof(path), "%s/lines", bench_dir);
+  bench_write_file(path, data, len * n);
+  free(data);
+
+  for (round = 0; round < BENCH_ROUNDS; round++) {
+    f = fopen(path, "r");
+    t = bench_now();
+    while ((line = soshell_read_line(f)) != NULL) {
+      free(line);
+    }
+    t = bench_now() - t;
+    fclose(f);
+    best = (round == 0 || t < best) ? t : best;
+  }
+  bench_add("read_line", n, best)->bytes_per_op = len;
+}
+
+/*
+  soshell_split_line() on a line of eleven words.
+ */
+static void bench_split_line(void)
+{
+  const char *sample = "find . -name *.c -type f -size +10k -print | wc -l";
+  char line[128], **args;
+  long n = 1000000, i;
+  double best = 0, t;
+  int round;
+
+  for (round = 0; round < BENCH_ROUNDS; round++) {
+    t = bench_now();
+    for (i = 0; i < n; i++) {
+      strcpy(line, sample);
+      args = soshell_split_line(line);
+      free(args);
+    }
+    t = bench_now() - t;
+    best = (round == 0 || t < best) ? t : best;
+  }
+  bench_add("split_line", n, best);
+}
+
+/*
+  Builtin lookup and dispatch through soshell_execute(), with a
+  builtin that does next to nothing.
+ */
+static void bench_dispatch(void)
+{
+  char *args[] = { "cd", ".", NULL };
+  long n = 1000000, i;
+  double best = 0, t;
+  int round;
+
+  for (round = 0; round < BENCH_ROUNDS; round++) {
+    t = bench_now();
+    for (i = 0; i < n; i++) {
+      soshell_execute(args);
+    }
+    t = bench_now() - t;
+    best = (round == 0 || t < best) ? t : best;
+  }
+  bench_add("dispatch", n, best);
+}
+
+/*
+  A counting loop, i=$((i+1)) run as a command line, and the evaluation
+  of a cached expression on its own.
+ */
+static void bench_arith(void)
+{
+  long n = 1000000, i;
+  int64_t value;
+  double best = 0, t;
+  char *line;
+  int round;
+
+  for (round = 0; round < BENCH_ROUNDS; round++) {
+    t = bench_now();
+    for (i = 0; i < n; i++) {
+      line = strdup("i=$((i+1))");
+      if (!line) {
+        fprintf(stderr, "soshell: allocation error\n");
+        exit(EXIT_FAILURE);
+      }
+      soshell_run_line(line);
+    }
+    t = bench_now() - t;
+    best = (round == 0 || t < best) ? t : best;
+  }
+  bench_add("arith_count", n, best);
+
+  for (round = 0; round < BENCH_ROUNDS; round++) {
+    t = bench_now();
+    for (i = 0; i < n; i++) {
+      soshell_arith_eval("(i * 3 + 7) % 1000 << 2", &value);
+    }
+    t = bench_now() - t;
+    best = (round == 0 || t < best) ? t : best;
+  }
+  bench_add("arith_eval", n, best);
+}
+
+/*
+  Pathname expansion over the 100k-file tree, through one level of
+  directories and with **.  Listings are cached after the first round.
+ */
+static void bench_glob_one(const char *name, const char *fmt)
+{
+  char pattern[96], *args[] = { pattern, NULL };
+  long n = 20, i;
+  double best = 0, t;
+  int round;
+
+  snprintf(pattern, sizeof(pattern), fmt, bench_tree());
+  for (round = 0; round < BENCH_ROUNDS; round++) {
+    t = bench_now();
+    for (i = 0; i < n; i++) {
+      soshell_glob_expand(args);
+      soshell_arena_reset();
+    }
+    t = bench_now() - t;
+    best = (round == 0 || t < best) ? t : best;
+  }
+  bench_add(name, n, best);
+}
+
+static void bench_glob(void)
+{
+  bench_glob_one("glob_100k", "%s/d*/*.c");
+  bench_glob_one("globstar_100k", "%s/**/*.c");
+}
+
+/*
+  Spawn latency of soshell_launch(), with per-spawn percentiles.
+ */
+static void bench_launch(const char *name, char **args, int n)
+{
+  double *samples = malloc(n * sizeof(double)), best = 0, total, t;
+  struct bench_result *r;
+  int round, i;
+
+  if (!samples) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  for (round = 0; round < BENCH_ROUNDS; round++) {
+    total = 0;
+    for (i = 0; i < n; i++) {
+      t = bench_now();
+      soshell_launch(args);
+      samples[i] = bench_now() - t;
+      total += samples[i];
+    }
+    best = (round == 0 || total < best) ? total : best;
+  }
+  // Percentiles are from the last round.
+  qsort(samples, n, sizeof(double), bench_cmp);
+  r = bench_add(name, n, best);
+  r->p50 = samples[n / 2];
+  r->p99 = samples[n * 99 / 100];
+  free(samples);
+}
+
+/*
+  Latency of one command line through soshell_run_line(), with
+  per-line percentiles.
+ */
+static void bench_line(const char *name, const char *text, int n)
+{
+  double *samples = malloc(n * sizeof(double)), best = 0, total, t;
+  struct bench_result *r;
+  char *line;
+  int round, i;
+
+  if (!samples) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  for (round = 0; round < BENCH_ROUNDS; round++) {
+    total = 0;
+    for (i = 0; i < n; i++) {
+      line = strdup(text);
+      if (!line) {
+        fprintf(stderr, "soshell: allocation error\n");
+        exit(EXIT_FAILURE);
+      }
+      t = bench_now();
+      soshell_run_line(line);
+      soshell_out_flush();
+      samples[i] = bench_now() - t;
+      total += samples[i];
+    }
+    best = (round == 0 || total < best) ? total : best;
+  }
+  qsort(samples, n, sizeof(double), bench_cmp);
+  r = bench_add(name, n, best);
+  r->p50 = samples[n / 2];
+  r->p99 = samples[n * 99 / 100];
+  free(samples);
+}
+
+/*
+  A two-stage pipeline of builtins, which runs without forking, and
+  the same pipeline with the external cat and wc.
+ */
+static void bench_pipeline(void)
+{
+  char path[64], cat[PATH_MAX], wc[PATH_MAX], line[3 * PATH_MAX];
+
+  snprintf(path, sizeof(path), "%s/small", bench_dir);
+  bench_write_file(path, "one line\n", 9);
+  snprintf(line, sizeof(line), "cat %s | wc -l", path);
+  bench_line("pipeline_builtin", line, BENCH_PIPELINES);
+  if (soshell_path_lookup("cat", cat, sizeof(cat)) != 0 ||
+      soshell_path_lookup("wc", wc, sizeof(wc)) != 0) {
+    return;
+  }
+  snprintf(line, sizeof(line), "%s %s | %s -l", cat, path, wc);
+  bench_line("pipeline_external", line, BENCH_PIPELINES);
+}
+
+/*
+  Time a builtin with its output on fd, as one operation over size
+  bytes.
+ */
+static void bench_builtin_to(const char *name, char **args, int fd, off_t size)
+{
+  soshell_builtin_fn builtin = soshell_find_builtin(args[0]);
+  int saved = dup(STDOUT_FILENO), round;
+  double best = 0, t;
+
+  dup2(fd, STDOUT_FILENO);
+  for (round = 0; round < BENCH_ROUNDS; round++) {
+    if (ftruncate(fd, 0) == 0) {
+      lseek(fd, 0, SEEK_SET);
+    }
+    t = bench_now();
+    builtin(args);
+    soshell_out_flush();
+    t = bench_now() - t;
+    best = (round == 0 || t < best) ? t : best;
+  }
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+  bench_add(name, 1, best)->bytes_per_op = size;
+}
+
+/*
+  cat of the data file into a regular file (copy_file_range) and into
+  a pipe drained by a child (splice).
+ */
+static void bench_cat(void)
+{
+  char *args[] = { "cat", (char *)bench_data(), NULL }, path[64], buf[65536];
+  int fd, fds[2];
+  pid_t pid;
+
+  snprintf(path, sizeof(path), "%s/cat", bench_dir);
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd >= 0) {
+    bench_builtin_to("cat_file", args, fd, BENCH_DATA);
+    close(fd);
+    unlink(path);
+  }
+  if (pipe(fds) != 0) {
+    return;
+  }
+  pid = fork();
+  if (pid == 0) {
+    close(fds[1]);
+    while (read(fds[0], buf, sizeof(buf)) > 0) {}
+    _exit(EXIT_SUCCESS);
+  }
+  close(fds[0]);
+  if (pid > 0) {
+    bench_builtin_to("cat_pipe", args, fds[1], BENCH_DATA);
+  }
+  close(fds[1]);
+  if (pid > 0) {
+    waitpid(pid, NULL, 0);
+  }
+}
+
+/*
+  wc over the data file: lines only, and lines, words and bytes.
+ */
+static void bench_wc(void)
+{
+  char *lines[] = { "wc", "-l", (char *)bench_data(), NULL };
+  char *all[] = { "wc", (char *)bench_data(), NULL };
+  int fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+  if (fd < 0) {
+    return;
+  }
+  bench_builtin_to("wc_l", lines, fd, BENCH_DATA);
+  bench_builtin_to("wc", all, fd, BENCH_DATA);
+  close(fd);
+}
+
+/*
+  cp -r of the 100k-file tree, by the builtin and by the cp in PATH.
+  The copy is removed between rounds, outside the timing.
+ */
+static void bench_cp_one(const char *name, int builtin)
+{
+  char dst[64], cmd[96];
+  char *args[] = { "cp", "-r", (char *)bench_tree(), dst, NULL };
+  double best = 0, t;
+  int round;
+
+  snprintf(dst, sizeof(dst), "%s/copy", bench_dir);
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", dst);
+  // Each round is 100k files: fewer rounds than the other benchmarks.
+  for (round = 0; round < BENCH_CP_ROUNDS; round++) {
+    // The previous copy is written back first, not while this one runs.
+    sync();
+    t = bench_now();
+    if (builtin) {
+      soshell_find_builtin("cp")(args);
+    } else {
+      soshell_launch(args);
+    }
+    t = bench_now() - t;
+    best = (round == 0 || t < best) ? t : best;
+    if (system(cmd) != 0) {
+      fprintf(stderr, "bench: could not remove %s\n", dst);
+    }
+  }
+  bench_add(name, BENCH_TREE_DIRS * BENCH_TREE_FILES, best);
+}
+
+static void bench_cp(void)
+{
+  bench_cp_one("cp_tree_builtin", 1);
+  bench_cp_one("cp_tree_coreutils", 0);
+}
+
+/*
+  The ls builtin on a directory of BENCH_LS_FILES entries.
+ */
+static void bench_ls(void)
+{
+  char dir[64], path[96];
+  char *args[] = { "ls", dir, NULL };
+  soshell_builtin_fn ls = soshell_find_builtin("ls");
+  long n = 50, i;
+  double best = 0, t;
+  int round, fd;
+
+  snprintf(dir, sizeof(dir), "%s/ls", bench_dir);
+  mkdir(dir, 0700);
+  for (i = 0; i < BENCH_LS_FILES; i++) {
+    snprintf(path, sizeof(path), "%s/file%06ld", dir, i);
+    fd = open(path, O_WRONLY | O_CREAT, 0600);
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  for (round = 0; round < BENCH_ROUNDS; round++) {
+    t = bench_now();
+    for (i = 0; i < n; i++) {
+      ls(args);
+      soshell_out_flush();
+    }
+    t = bench_now() - t;
+    best = (round == 0 || t < best) ? t : best;
+  }
+  bench_add("ls_10k", n, best);
+}
+
+/*
+  A script of builtins, assignments and arithmetic run through
+  soshell_loop(), as "soshell script" would.
+ */
+static void bench_script(void)
+{
+  static const char *lines[] = {
+    "i=$((i+1))", "cd .", "x=foo", "y=$((i*2+1))", "wc -c %s/lines", "cd /tmp"
+  };
+  long n = 20000, i;
+  char path[64], buf[128];
+  double best = 0, t;
+  FILE *f;
+  int round;
+
+  snprintf(path, sizeof(path), "%s/script", bench_dir);
+  f = fopen(path, "w");
+  if (f == NULL) {
+    fprintf(stderr, "bench: %s: %s\n", path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < n; i++) {
+    snprintf(buf, sizeof(buf), lines[i % 6], bench_dir);
+    fprintf(f, "%s\n", buf);
+  }
+  fclose(f);
+
+  for (round = 0; round < BENCH_ROUNDS; round++) {
+    f = fopen(path, "r");
+    t = bench_now();
+    soshell_loop(f);
+    soshell_out_flush();
+    t = bench_now() - t;
+    fclose(f);
+    best = (round == 0 || t < best) ? t : best;
+  }
+  bench_add("script", n, best);
+}
+
+/*
+  Spawn latency through the fork server and directly, with a 1 GB heap
+  in the shell: fork() copies the page tables of the whole heap, the
+  zygote was forked before it existed.
+ */
+static void bench_zygote(char **args)
+{
+  char *heap;
+
+  if (soshell_zygote_start() != 0) {
+    return;
+  }
+  bench_launch("launch_true_zygote", args, BENCH_SPAWNS);
+  heap = mmap(NULL, BENCH_HEAP, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (heap == MAP_FAILED) {
+    fprintf(stderr, "bench: %s\n", strerror(errno));
+    return;
+  }
+  // A long-lived heap is in small pages; touch each so it is copied.
+  madvise(heap, BENCH_HEAP, MADV_NOHUGEPAGE);
+  memset(heap, 1, BENCH_HEAP);
+  bench_launch("launch_true_zygote_1g", args, BENCH_SPAWNS);
+  soshell_zygote_stop();
+  // Each of these forks copies the page tables: keep it short.
+  bench_launch("launch_true_1g", args, BENCH_SPAWNS / 10);
+  munmap(heap, BENCH_HEAP);
+}
+
+static void bench_print(const char *commit)
+{
+  struct bench_result *r;
+  int i;
+
+  printf("{\n  \"commit\": \"%s\",\n  \"rounds\": %d,\n  \"results\": [\n", commit, BENCH_ROUNDS);
+  for (i = 0; i < bench_nresults; i++) {
+    r = &bench_results[i];
+    printf("    {\"name\": \"%s\", \"ops\": %ld, \"ns_per_op\": %.1f", r->name, r->ops, r->ns_per_op);
+    if (r->p50 > 0) {
+      printf(", \"p50_ns\": %.0f, \"p99_ns\": %.0f", r->p50, r->p99);
+    }
+    if (r->bytes_per_op > 0) {
+      printf(", \"mb_per_s\": %.1f", r->bytes_per_op / r->ns_per_op * 1e3);
+    }
+    printf("}%s\n", i + 1 < bench_nresults ? "," : "");
+  }
+  printf("  ]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+  char *true_args[] = { "true", NULL };
+  char *exit_args[] = { "sh", "-c", "exit 0", NULL };
+  char cmd[64];
+  int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC), stdout_fd;
+
+  if (mkdtemp(bench_dir) == NULL || null_fd < 0) {
+    fprintf(stderr, "bench: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+  // Builtins and launched commands write to /dev/null; results to stdout.
+  fflush(stdout);
+  stdout_fd = dup(STDOUT_FILENO);
+  dup2(null_fd, STDOUT_FILENO);
+  close(null_fd);
+
+  bench_read_line();
+  bench_split_line();
+  bench_dispatch();
+  bench_arith();
+  bench_glob();
+  bench_launch("launch_true", true_args, BENCH_SPAWNS);
+  bench_launch("launch_sh_exit", exit_args, BENCH_SPAWNS);
+  bench_ls();
+  bench_pipeline();
+  bench_cat();
+  bench_wc();
+  bench_cp();
+  bench_script();
+  bench_zygote(true_args);
+
+  dup2(stdout_fd, STDOUT_FILENO);
+  close(stdout_fd);
+  bench_print(argc > 1 ? argv[1] : "");
+
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", bench_dir);
+  if (system(cmd) != 0) {
+    fprintf(stderr, "bench: could not remove %s\n", bench_dir);
+  }
+  return EXIT_SUCCESS;
+}
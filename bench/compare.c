@@ -0,0 +1,207 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/*
+  Runs the same scripts through soshell and every reference shell found
+  in PATH (bash, dash, busybox sh) and reports them side by side.  Run
+  by "make bench-compare".
+
+  Each workload is a script file generated in a temporary directory,
+  written in the subset of sh that all of them accept.  Every shell runs
+  every script COMPARE_RUNS times, with output to /dev/null; per-run wall
+  times give the percentiles, and the median the throughput in script
+  lines per second.  A table goes to stderr and JSON to stdout.
+ */
+
+#define COMPARE_RUNS 20
+#define COMPARE_GLOB_FILES 2000
+
+struct compare_shell {
+  const char *name;
+  char *argv[4];           /* command, then the script is appended */
+};
+
+struct compare_workload {
+  const char *name;
+  long lines;
+  char path[96];
+};
+
+static char compare_dir[] = "/tmp/soshell-compare.XXXXXX";
+
+static double compare_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare_cmp(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+static int compare_in_path(const char *name)
+{
+  const char *path = getenv("PATH"), *end;
+  char full[4096];
+
+  for (; path != NULL && *path != '\0'; path = *end ? end + 1 : end) {
+    end = strchrnul(path, ':');
+    snprintf(full, sizeof(full), "%.*s/%s", (int)(end - path), path, name);
+    if (access(full, X_OK) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+  Write a workload script: lines copies of the lines in body, cycled,
+  with %s replaced by the temporary directory.
+ */
+static void compare_script(struct compare_workload *w, const char *name,
+                           const char **body, int nbody, long lines)
+{
+  FILE *f;
+  long i;
+
+  w->name = name;
+  w->lines = lines;
+  snprintf(w->path, sizeof(w->path), "%s/%s.sh", compare_dir, name);
+  f = fopen(w->path, "w");
+  if (f == NULL) {
+    fprintf(stderr, "compare: %s: %s\n", w->path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < lines; i++) {
+    fprintf(f, body[i % nbody], compare_dir);
+    fputc('\n', f);
+  }
+  fclose(f);
+}
+
+/*
+  Run one script once; returns the wall time in ns, or -1.
+ */
+static double compare_run(const struct compare_shell *sh, const char *script)
+{
+  char *argv[6];
+  double t;
+  pid_t pid;
+  int i, status, fd;
+
+  for (i = 0; sh->argv[i] != NULL; i++) {
+    argv[i] = sh->argv[i];
+  }
+  argv[i++] = (char *)script;
+  argv[i] = NULL;
+
+  t = compare_now();
+  pid = fork();
+  if (pid == 0) {
+    fd = open("/dev/null", O_RDWR);
+    dup2(fd, STDIN_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    execvp(argv[0], argv);
+    _exit(127);
+  }
+  if (pid < 0) {
+    return -1;
+  }
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+  t = compare_now() - t;
+  return (WIFEXITED(status) && WEXITSTATUS(status) == 127) ? -1 : t;
+}
+
+int main(int argc, char **argv)
+{
+  static const char *spawn[] = { "/bin/true" };
+  static const char *script[] = {
+    "i=$((i+1))", "cd .", "x=foo", "y=$((i*2+1))", "cd /tmp"
+  };
+  static const char *pipeline[] = { "seq 1 2000 | sort -r | wc -l" };
+  static const char *glob[] = { "cd %s/g/d12*", "cd /" };
+  struct compare_shell shells[] = {
+    { "soshell", { "./soshell", NULL } },
+    { "bash", { "bash", NULL } },
+    { "dash", { "dash", NULL } },
+    { "busybox", { "busybox", "sh", NULL } }
+  };
+  struct compare_workload work[4];
+  double samples[COMPARE_RUNS], p50, p90, p99;
+  char path[128], cmd[96];
+  int nshells = sizeof(shells) / sizeof(shells[0]);
+  int s, w, r, fd, first = 1;
+
+  if (argc > 1) {
+    shells[0].argv[0] = argv[1];
+  }
+  if (mkdtemp(compare_dir) == NULL) {
+    fprintf(stderr, "compare: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+  snprintf(path, sizeof(path), "%s/g", compare_dir);
+  mkdir(path, 0700);
+  for (r = 0; r < COMPARE_GLOB_FILES; r++) {
+    snprintf(path, sizeof(path), "%s/g/f%05d.txt", compare_dir, r);
+    if ((fd = open(path, O_WRONLY | O_CREAT, 0600)) >= 0) {
+      close(fd);
+    }
+  }
+  snprintf(path, sizeof(path), "%s/g/d1234", compare_dir);
+  mkdir(path, 0700);
+
+  compare_script(&work[0], "spawn", spawn, 1, 200);
+  compare_script(&work[1], "script", script, 5, 20000);
+  compare_script(&work[2], "pipeline", pipeline, 1, 100);
+  compare_script(&work[3], "glob", glob, 2, 2000);
+
+  fprintf(stderr, "%-10s %-9s %10s %10s %10s %12s\n",
+          "workload", "shell", "p50 ms", "p90 ms", "p99 ms", "lines/s");
+  printf("{\n  \"runs\": %d,\n  \"results\": [\n", COMPARE_RUNS);
+  for (w = 0; w < 4; w++) {
+    for (s = 0; s < nshells; s++) {
+      if (s > 0 && !compare_in_path(shells[s].argv[0])) {
+        continue;
+      }
+      // One warm-up run, which also checks the shell can run at all.
+      if (compare_run(&shells[s], work[w].path) < 0) {
+        fprintf(stderr, "compare: %s could not run %s\n", shells[s].name, work[w].name);
+        continue;
+      }
+      for (r = 0; r < COMPARE_RUNS; r++) {
+        samples[r] = compare_run(&shells[s], work[w].path);
+      }
+      qsort(samples, COMPARE_RUNS, sizeof(double), compare_cmp);
+      p50 = samples[COMPARE_RUNS / 2] / 1e6;
+      p90 = samples[COMPARE_RUNS * 90 / 100] / 1e6;
+      p99 = samples[COMPARE_RUNS - 1 - COMPARE_RUNS / 100] / 1e6;
+      fprintf(stderr, "%-10s %-9s %10.2f %10.2f %10.2f %12.0f\n", work[w].name,
+              shells[s].name, p50, p90, p99, work[w].lines / (p50 / 1e3));
+      printf("%s    {\"workload\": \"%s\", \"shell\": \"%s\", \"lines\": %ld, "
+             "\"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"lines_per_s\": %.0f}",
+             first ? "" : ",\n", work[w].name, shells[s].name, work[w].lines,
+             p50, p90, p99, work[w].lines / (p50 / 1e3));
+      first = 0;
+    }
+  }
+  printf("\n  ]\n}\n");
+
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", compare_dir);
+  if (system(cmd) != 0) {
+    fprintf(stderr, "compare: could not remove %s\n", compare_dir);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,377 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "alias.h"
+#include "arena.h"
+#include "io.h"
+
+/*
+  Aliases are kept in a hash table keyed by name.  Expanding one splices
+  its words into the command's argument vector, in the per-command
+  arena, so a command that uses an alias is never split again.
+
+  The first word of a command, the first after each |, and the word
+  after the expansion of an alias whose value ends in a blank are
+  looked up.  As in POSIX sh, the words an alias expands to are not
+  expanded again by the same alias, which stops loops like
+  alias ls='ls -F' or a=b, b=a.
+
+  A command may still be using the words of an alias when it redefines
+  or removes it, so replaced definitions are only freed when the next
+  command is expanded.
+ */
+
+#define ALIAS_BUCKETS 64
+#define ALIAS_DEPTH 32
+#define ALIAS_DELIM " \t\r\n\a"
+
+static struct soshell_alias *alias_table[ALIAS_BUCKETS];
+static struct soshell_alias *alias_retired;
+static unsigned long alias_gen;
+static int alias_count;
+
+static unsigned long alias_hash(const char *name)
+{
+  unsigned long h = 2166136261UL;
+
+  for (; *name != '\0'; name++) {
+    h = (h ^ (unsigned char)*name) * 16777619UL;
+  }
+  return h % ALIAS_BUCKETS;
+}
+
+static struct soshell_alias **alias_find(const char *name)
+{
+  struct soshell_alias **p;
+
+  for (p = &alias_table[alias_hash(name)]; *p != NULL; p = &(*p)->next) {
+    if (strcmp((*p)->name, name) == 0) {
+      return p;
+    }
+  }
+  return p;
+}
+
+static void alias_remove(struct soshell_alias **p)
+{
+  struct soshell_alias *a = *p;
+
+  *p = a->next;
+  a->next = alias_retired;
+  alias_retired = a;
+  alias_count--;
+}
+
+/*
+  Enter a definition; block holds the name, the value and its words,
+  and is taken over.
+ */
+static void alias_enter(char *block, size_t len, int argc)
+{
+  struct soshell_alias *a = malloc(sizeof(*a));
+  struct soshell_alias **p;
+  char *s;
+  int i;
+
+  if (a != NULL) {
+    a->argv = malloc((argc + 1) * sizeof(char *));
+  }
+  if (a == NULL || a->argv == NULL) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  a->name = block;
+  a->len = len;
+  a->value = block + strlen(block) + 1;
+  s = a->value + strlen(a->value) + 1;
+  for (i = 0; i < argc; i++) {
+    a->argv[i] = s;
+    s += strlen(s) + 1;
+  }
+  a->argv[argc] = NULL;
+  a->argc = argc;
+  len = strlen(a->value);
+  a->chain = len > 0 && strchr(ALIAS_DELIM, a->value[len - 1]) != NULL;
+  a->gen = ++alias_gen;
+
+  p = alias_find(a->name);
+  if (*p != NULL) {
+    alias_remove(p);
+  }
+  a->next = alias_table[alias_hash(a->name)];
+  alias_table[alias_hash(a->name)] = a;
+  alias_count++;
+}
+
+/*
+  Define name as value, splitting the value into words.
+ */
+static void alias_define(const char *name, size_t nlen, const char *value, size_t vlen)
+{
+  char *block, *copy, *word, *p, *save;
+  int argc = 0;
+
+  // At most: name, value, and the value's words.
+  block = malloc(nlen + 1 + 2 * (vlen + 1));
+  copy = strndup(value, vlen);
+  if (!block || !copy) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(block, name, nlen);
+  block[nlen] = '\0';
+  p = stpcpy(block + nlen + 1, copy) + 1;
+  for (word = strtok_r(copy, ALIAS_DELIM, &save); word != NULL;
+       word = strtok_r(NULL, ALIAS_DELIM, &save)) {
+    p = stpcpy(p, word) + 1;
+    argc++;
+  }
+  free(copy);
+  alias_enter(block, p - block, argc);
+}
+
+/**
+   @brief Define an alias from a block saved by the startup snapshot.
+   @param block Name, value and words, each NUL terminated.
+   @param len Bytes in the block.
+ */
+void soshell_alias_load(const char *block, size_t len)
+{
+  const char *p;
+  char *copy;
+  int argc = -2;
+
+  for (p = block; p < block + len; p += strlen(p) + 1) {
+    argc++;
+  }
+  copy = malloc(len);
+  if (!copy) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(copy, block, len);
+  alias_enter(copy, len, argc < 0 ? 0 : argc);
+}
+
+/**
+   @brief Count of definitions made so far, to find the ones made later.
+   @return The current generation.
+ */
+unsigned long soshell_alias_generation(void)
+{
+  return alias_gen;
+}
+
+/**
+   @brief Call fn for every alias defined after generation gen.
+   @param gen Value from soshell_alias_generation().
+   @param fn Called with each alias and arg.
+   @param arg Passed to fn.
+ */
+void soshell_alias_each_since(unsigned long gen,
+                              void (*fn)(const struct soshell_alias *, void *), void *arg)
+{
+  struct soshell_alias *a;
+  int i;
+
+  for (i = 0; i < ALIAS_BUCKETS; i++) {
+    for (a = alias_table[i]; a != NULL; a = a->next) {
+      if (a->gen > gen) {
+        fn(a, arg);
+      }
+    }
+  }
+}
+
+/*
+  Replace args[i] with the words of a; returns the new vector.
+ */
+static char **alias_splice(char **args, size_t *n, size_t i, const struct soshell_alias *a)
+{
+  char **out = soshell_arena_alloc((*n + a->argc) * sizeof(char *));
+
+  memcpy(out, args, i * sizeof(char *));
+  memcpy(out + i, a->argv, a->argc * sizeof(char *));
+  memcpy(out + i + a->argc, args + i + 1, (*n - i) * sizeof(char *));
+  *n += a->argc - 1;
+  return out;
+}
+
+/**
+   @brief Expand aliases in a command.
+   @param args Null terminated list of words.
+   @return args, or a new vector in the arena with aliases expanded.
+ */
+char **soshell_alias_expand(char **args)
+{
+  const struct soshell_alias *seen[ALIAS_DEPTH], *a;
+  struct soshell_alias **p, *dead;
+  size_t i, n, next_cmd = 0, seen_end = 0;
+  int nseen = 0, k;
+
+  while (alias_retired != NULL) {
+    dead = alias_retired;
+    alias_retired = dead->next;
+    free(dead->argv);
+    free(dead->name);
+    free(dead);
+  }
+  if (alias_count == 0) {
+    return args;
+  }
+
+  for (n = 0; args[n] != NULL; n++) {}
+  for (i = 0; args[i] != NULL; i++) {
+    if (i != next_cmd && (i == 0 || strcmp(args[i - 1], "|") != 0)) {
+      continue;
+    }
+    // Past the words of the last expansion, any alias may be used again.
+    if (i >= seen_end) {
+      nseen = 0;
+    }
+    while (args[i] != NULL && nseen < ALIAS_DEPTH && *(p = alias_find(args[i])) != NULL) {
+      a = *p;
+      for (k = 0; k < nseen && seen[k] != a; k++) {}
+      if (k < nseen) {
+        break;
+      }
+      seen[nseen++] = a;
+      args = alias_splice(args, &n, i, a);
+      seen_end = (i < seen_end) ? seen_end + a->argc - 1 : i + a->argc;
+      if (next_cmd > i) {
+        next_cmd += a->argc - 1;
+      }
+      if (a->chain) {
+        next_cmd = i + a->argc;
+      }
+    }
+    if (args[i] == NULL) {
+      break;
+    }
+  }
+  return args;
+}
+
+static void alias_print(const struct soshell_alias *a)
+{
+  soshell_out_printf("alias %s='%s'\n", a->name, a->value);
+}
+
+/**
+   @brief Builtin command: define or show aliases.
+   @param args List of args.  args[0] is "alias", then name=value to
+   define and name to show; none shows all.  Values may be quoted.
+   @return Always returns 1, to continue executing.
+ */
+int soshell_alias(char **args)
+{
+  struct soshell_alias *a, **p;
+  char *line, *s, *name, *value, *end;
+  size_t len = 1;
+  char quote;
+  int i;
+
+  if (args[1] == NULL) {
+    for (i = 0; i < ALIAS_BUCKETS; i++) {
+      for (a = alias_table[i]; a != NULL; a = a->next) {
+        alias_print(a);
+      }
+    }
+    return 1;
+  }
+
+  // Quotes may span words: parse the arguments joined back together.
+  for (i = 1; args[i] != NULL; i++) {
+    len += strlen(args[i]) + 1;
+  }
+  line = malloc(len);
+  if (!line) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  s = line;
+  for (i = 1; args[i] != NULL; i++) {
+    s = stpcpy(s, args[i]);
+    *s++ = ' ';
+  }
+  *s = '\0';
+
+  s = line;
+  for (;;) {
+    s += strspn(s, ALIAS_DELIM);
+    if (*s == '\0') {
+      break;
+    }
+    name = s;
+    s += strcspn(s, "=" ALIAS_DELIM);
+    if (*s != '=') {
+      if (*s != '\0') {
+        *s++ = '\0';
+      }
+      p = alias_find(name);
+      if (*p != NULL) {
+        alias_print(*p);
+      } else {
+        fprintf(stderr, "soshell: alias: %s: not found\n", name);
+      }
+      continue;
+    }
+    *s++ = '\0';
+    if (*s == '\'' || *s == '"') {
+      quote = *s++;
+      value = s;
+      s = strchrnul(s, quote);
+      end = s;
+      if (*s != '\0') {
+        s++;
+      }
+    } else {
+      value = s;
+      s += strcspn(s, ALIAS_DELIM);
+      end = s;
+    }
+    if (name[0] == '\0' || strpbrk(name, "|/") != NULL) {
+      fprintf(stderr, "soshell: alias: %s: invalid alias name\n", name);
+      continue;
+    }
+    alias_define(name, strlen(name), value, end - value);
+  }
+  free(line);
+  return 1;
+}
+
+/**
+   @brief Builtin command: remove aliases.
+   @param args List of args.  args[0] is "unalias", then the names, or
+   -a to remove all.
+   @return Always returns 1, to continue executing.
+ */
+int soshell_unalias(char **args)
+{
+  struct soshell_alias **p;
+  int i;
+
+  if (args[1] == NULL) {
+    fprintf(stderr, "soshell: unalias: usage: unalias [-a] name...\n");
+    return 1;
+  }
+  if (strcmp(args[1], "-a") == 0) {
+    for (i = 0; i < ALIAS_BUCKETS; i++) {
+      while (alias_table[i] != NULL) {
+        alias_remove(&alias_table[i]);
+      }
+    }
+    return 1;
+  }
+  for (i = 1; args[i] != NULL; i++) {
+    p = alias_find(args[i]);
+    if (*p == NULL) {
+      fprintf(stderr, "soshell: unalias: %s: not found\n", args[i]);
+    } else {
+      alias_remove(p);
+    }
+  }
+  return 1;
+}
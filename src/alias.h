@@ -0,0 +1,30 @@
+#ifndef SOSHELL_ALIAS_H
+#define SOSHELL_ALIAS_H
+
+#include <stddef.h>
+
+/*
+  Alias.  The definition is split into words once, when it is made; the
+  name, the value and the words live in one block, NUL separated, which
+  is also how the startup snapshot stores it.
+ */
+struct soshell_alias {
+  char *name;              /* start of the block */
+  size_t len;              /* bytes in the block */
+  char *value;
+  char **argv;             /* words of the value, NULL terminated */
+  int argc;
+  int chain;               /* value ends in a blank: expand the next word too */
+  unsigned long gen;       /* soshell_alias_generation() when defined */
+  struct soshell_alias *next;
+};
+
+int soshell_alias(char **args);
+int soshell_unalias(char **args);
+char **soshell_alias_expand(char **args);
+void soshell_alias_load(const char *block, size_t len);
+unsigned long soshell_alias_generation(void);
+void soshell_alias_each_since(unsigned long gen,
+                              void (*fn)(const struct soshell_alias *, void *), void *arg);
+
+#endif
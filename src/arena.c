@@ -0,0 +1,89 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.h"
+#include "stats.h"
+
+#define SOSHELL_ARENA_BLOCK (64 * 1024)
+#define SOSHELL_ARENA_ALIGN 16
+
+struct arena_block {
+  struct arena_block *next;
+  size_t size;
+  size_t used;
+  char data[];
+};
+
+/* The first block is kept across resets; it is the one most commands fit in. */
+static struct arena_block *arena_head;
+
+/**
+   @brief Allocate memory that lives until the end of the current command.
+   @param size Number of bytes.
+   @return The memory, suitably aligned for any type.
+ */
+void *soshell_arena_alloc(size_t size)
+{
+  struct arena_block *block = arena_head;
+  size_t bsize;
+  void *p;
+
+  size = (size + SOSHELL_ARENA_ALIGN - 1) & ~(size_t)(SOSHELL_ARENA_ALIGN - 1);
+  if (block == NULL || block->size - block->used < size) {
+    bsize = (size > SOSHELL_ARENA_BLOCK) ? size : SOSHELL_ARENA_BLOCK;
+    block = malloc(sizeof(*block) + bsize);
+    if (!block) {
+      fprintf(stderr, "soshell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+    block->size = bsize;
+    block->used = 0;
+    block->next = arena_head;
+    arena_head = block;
+    soshell_counters.arena_blocks++;
+  }
+
+  p = block->data + block->used;
+  block->used += size;
+  soshell_counters.arena_allocs++;
+  soshell_counters.arena_bytes += size;
+  if (soshell_counters.arena_bytes > soshell_counters.arena_high) {
+    soshell_counters.arena_high = soshell_counters.arena_bytes;
+  }
+  return p;
+}
+
+/**
+   @brief Copy a string into the arena.
+   @param s The string.
+   @param len Number of bytes to copy; a NUL is appended.
+   @return The copy.
+ */
+char *soshell_arena_strndup(const char *s, size_t len)
+{
+  char *copy = soshell_arena_alloc(len + 1);
+
+  memcpy(copy, s, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+/**
+   @brief Release everything allocated since the last reset.
+ */
+void soshell_arena_reset(void)
+{
+  struct arena_block *block;
+
+  soshell_counters.arena_bytes = 0;
+  if (arena_head == NULL) {
+    return;
+  }
+  while (arena_head->next != NULL) {
+    block = arena_head;
+    arena_head = block->next;
+    free(block);
+  }
+  arena_head->used = 0;
+}
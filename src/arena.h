@@ -0,0 +1,15 @@
+#ifndef SOSHELL_ARENA_H
+#define SOSHELL_ARENA_H
+
+#include <stddef.h>
+
+/*
+  Per-command bump allocator.  Everything allocated while a command line
+  is expanded and run lives until soshell_arena_reset() is called at the
+  end of the command, so expansions never have to track their memory.
+ */
+void *soshell_arena_alloc(size_t size);
+char *soshell_arena_strndup(const char *s, size_t len);
+void soshell_arena_reset(void);
+
+#endif
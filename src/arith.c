@@ -0,0 +1,754 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "arith.h"
+#include "var.h"
+
+/*
+  Arithmetic expansion, $(( expr )).
+
+  Expressions are parsed once into a tree, with constant subtrees folded
+  while parsing, and kept in a small cache keyed by the expression text,
+  so a line that is run over and over only pays for evaluation.
+  Variable references are bound to their soshell_var entry at parse
+  time and read through its integer slot, so counters never go through
+  a string conversion.
+ */
+
+enum arith_op {
+  ARITH_NUM,
+  ARITH_VAR,
+  ARITH_NEG,
+  ARITH_POS,
+  ARITH_NOT,
+  ARITH_BNOT,
+  ARITH_MUL,
+  ARITH_DIV,
+  ARITH_MOD,
+  ARITH_ADD,
+  ARITH_SUB,
+  ARITH_SHL,
+  ARITH_SHR,
+  ARITH_LT,
+  ARITH_LE,
+  ARITH_GT,
+  ARITH_GE,
+  ARITH_EQ,
+  ARITH_NE,
+  ARITH_BAND,
+  ARITH_BXOR,
+  ARITH_BOR,
+  ARITH_LAND,
+  ARITH_LOR,
+  ARITH_COND,
+  ARITH_ASSIGN
+};
+
+struct arith_node {
+  enum arith_op op;
+  enum arith_op assign_op;   /* for ARITH_ASSIGN: operator of op=, or ARITH_NUM for = */
+  int64_t num;
+  struct soshell_var *var;
+  struct arith_node *a, *b, *c;
+};
+
+struct arith_parser {
+  const char *p;
+  const char *err;
+};
+
+static const char *arith_err;
+
+/*
+  Operators, longest first so that a prefix match is the right one.
+ */
+static const char *arith_ops[] = {
+  "<<=", ">>=",
+  "&&", "||", "==", "!=", "<=", ">=", "<<", ">>",
+  "*=", "/=", "%=", "+=", "-=", "&=", "^=", "|=",
+  "+", "-", "*", "/", "%", "<", ">", "&", "^", "|",
+  "!", "~", "?", ":", "(", ")", "=",
+  NULL
+};
+
+static struct arith_node *arith_parse_assign(struct arith_parser *ps);
+
+static struct arith_node *arith_node_new(enum arith_op op)
+{
+  struct arith_node *n = calloc(1, sizeof(*n));
+
+  if (n == NULL) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  n->op = op;
+  return n;
+}
+
+static void arith_node_free(struct arith_node *n)
+{
+  if (n == NULL) {
+    return;
+  }
+  arith_node_free(n->a);
+  arith_node_free(n->b);
+  arith_node_free(n->c);
+  free(n);
+}
+
+static void arith_skip_space(struct arith_parser *ps)
+{
+  while (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\n' || *ps->p == '\r') {
+    ps->p++;
+  }
+}
+
+static const char *arith_peek(struct arith_parser *ps)
+{
+  int i;
+
+  arith_skip_space(ps);
+  for (i = 0; arith_ops[i] != NULL; i++) {
+    if (strncmp(ps->p, arith_ops[i], strlen(arith_ops[i])) == 0) {
+      return arith_ops[i];
+    }
+  }
+  return NULL;
+}
+
+static int arith_accept(struct arith_parser *ps, const char *op)
+{
+  const char *next = arith_peek(ps);
+
+  if (next != NULL && strcmp(next, op) == 0) {
+    ps->p += strlen(op);
+    return 1;
+  }
+  return 0;
+}
+
+/*
+  Parse an integer constant: decimal, octal (leading 0) or hex (0x).
+  Advances *s past the digits.  Returns 0 on success.
+ */
+static int arith_parse_number(const char **s, int64_t *out)
+{
+  const char *p = *s;
+  uint64_t n = 0;
+  int base = 10;
+  int digits = 0;
+
+  if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+    base = 16;
+    p += 2;
+  } else if (p[0] == '0') {
+    base = 8;
+  }
+  for (;; p++) {
+    int d;
+    if (*p >= '0' && *p <= '9') {
+      d = *p - '0';
+    } else if (*p >= 'a' && *p <= 'f') {
+      d = *p - 'a' + 10;
+    } else if (*p >= 'A' && *p <= 'F') {
+      d = *p - 'A' + 10;
+    } else if (*p == '_' || (*p >= 'g' && *p <= 'z') || (*p >= 'G' && *p <= 'Z')) {
+      return -1;
+    } else {
+      break;
+    }
+    if (d >= base) {
+      return -1;
+    }
+    if (n > (UINT64_MAX - d) / base) {
+      return -1;
+    }
+    n = n * base + d;
+    digits++;
+  }
+  if (digits == 0) {
+    return -1;
+  }
+  *s = p;
+  *out = (int64_t)n;
+  return 0;
+}
+
+/*
+  Interpret a variable's string value as an integer.  An empty or
+  blank value counts as 0.
+ */
+static int arith_parse_value(const char *s, int64_t *out)
+{
+  int neg = 0;
+
+  while (*s == ' ' || *s == '\t' || *s == '\n') {
+    s++;
+  }
+  if (*s == '\0') {
+    *out = 0;
+    return 0;
+  }
+  if (*s == '-' || *s == '+') {
+    neg = (*s == '-');
+    s++;
+  }
+  if (arith_parse_number(&s, out) != 0) {
+    return -1;
+  }
+  while (*s == ' ' || *s == '\t' || *s == '\n') {
+    s++;
+  }
+  if (*s != '\0') {
+    return -1;
+  }
+  if (neg) {
+    *out = (int64_t)(0 - (uint64_t)*out);
+  }
+  return 0;
+}
+
+static int arith_read_var(struct soshell_var *var, int64_t *out)
+{
+  const char *value;
+
+  if (var->set) {
+    if (var->has_int) {
+      *out = var->ival;
+      return 0;
+    }
+    if (arith_parse_value(var->value, out) != 0) {
+      arith_err = "invalid integer in variable";
+      return -1;
+    }
+    // Remember the integer so later reads skip the parse.
+    var->ival = *out;
+    var->has_int = 1;
+    return 0;
+  }
+
+  value = getenv(var->name);
+  if (value == NULL) {
+    *out = 0;
+    return 0;
+  }
+  if (arith_parse_value(value, out) != 0) {
+    arith_err = "invalid integer in variable";
+    return -1;
+  }
+  return 0;
+}
+
+static int arith_binary(enum arith_op op, int64_t x, int64_t y, int64_t *out)
+{
+  uint64_t ux = (uint64_t)x, uy = (uint64_t)y;
+
+  switch (op) {
+  case ARITH_MUL:  *out = (int64_t)(ux * uy); break;
+  case ARITH_ADD:  *out = (int64_t)(ux + uy); break;
+  case ARITH_SUB:  *out = (int64_t)(ux - uy); break;
+  case ARITH_DIV:
+  case ARITH_MOD:
+    if (y == 0) {
+      arith_err = "division by zero";
+      return -1;
+    }
+    if (y == -1) {
+      // Avoid the INT64_MIN / -1 trap; the result wraps.
+      *out = (op == ARITH_DIV) ? (int64_t)(0 - ux) : 0;
+    } else {
+      *out = (op == ARITH_DIV) ? x / y : x % y;
+    }
+    break;
+  case ARITH_SHL:  *out = (int64_t)(ux << (y & 63)); break;
+  case ARITH_SHR:  *out = x >> (y & 63); break;
+  case ARITH_LT:   *out = x < y; break;
+  case ARITH_LE:   *out = x <= y; break;
+  case ARITH_GT:   *out = x > y; break;
+  case ARITH_GE:   *out = x >= y; break;
+  case ARITH_EQ:   *out = x == y; break;
+  case ARITH_NE:   *out = x != y; break;
+  case ARITH_BAND: *out = x & y; break;
+  case ARITH_BXOR: *out = x ^ y; break;
+  case ARITH_BOR:  *out = x | y; break;
+  default:
+    arith_err = "bad operator";
+    return -1;
+  }
+  return 0;
+}
+
+static int arith_eval_node(struct arith_node *n, int64_t *out)
+{
+  int64_t x, y;
+
+  switch (n->op) {
+  case ARITH_NUM:
+    *out = n->num;
+    return 0;
+  case ARITH_VAR:
+    return arith_read_var(n->var, out);
+  case ARITH_NEG:
+  case ARITH_POS:
+  case ARITH_NOT:
+  case ARITH_BNOT:
+    if (arith_eval_node(n->a, &x) != 0) {
+      return -1;
+    }
+    if (n->op == ARITH_NEG) {
+      *out = (int64_t)(0 - (uint64_t)x);
+    } else if (n->op == ARITH_POS) {
+      *out = x;
+    } else if (n->op == ARITH_NOT) {
+      *out = !x;
+    } else {
+      *out = ~x;
+    }
+    return 0;
+  case ARITH_LAND:
+  case ARITH_LOR:
+    if (arith_eval_node(n->a, &x) != 0) {
+      return -1;
+    }
+    if ((n->op == ARITH_LAND) ? !x : x) {
+      *out = (n->op == ARITH_LOR);
+      return 0;
+    }
+    if (arith_eval_node(n->b, &y) != 0) {
+      return -1;
+    }
+    *out = (y != 0);
+    return 0;
+  case ARITH_COND:
+    if (arith_eval_node(n->a, &x) != 0) {
+      return -1;
+    }
+    return arith_eval_node(x ? n->b : n->c, out);
+  case ARITH_ASSIGN:
+    if (arith_eval_node(n->b, &y) != 0) {
+      return -1;
+    }
+    if (n->assign_op != ARITH_NUM) {
+      if (arith_read_var(n->var, &x) != 0 ||
+          arith_binary(n->assign_op, x, y, &y) != 0) {
+        return -1;
+      }
+    }
+    soshell_var_set_int(n->var, y);
+    *out = y;
+    return 0;
+  default:
+    if (arith_eval_node(n->a, &x) != 0 || arith_eval_node(n->b, &y) != 0) {
+      return -1;
+    }
+    return arith_binary(n->op, x, y, out);
+  }
+}
+
+/*
+  Fold a freshly built node whose operands are constants.  Division by
+  zero is left alone so that it is reported when (and if) it is
+  evaluated.
+ */
+static struct arith_node *arith_fold(struct arith_node *n)
+{
+  struct arith_node *keep;
+  int64_t v;
+
+  if (n->op == ARITH_COND && n->a->op == ARITH_NUM) {
+    keep = n->a->num ? n->b : n->c;
+    if (n->a->num) {
+      n->b = NULL;
+    } else {
+      n->c = NULL;
+    }
+    arith_node_free(n);
+    return keep;
+  }
+  if ((n->op == ARITH_LAND || n->op == ARITH_LOR) && n->a->op == ARITH_NUM &&
+      ((n->op == ARITH_LAND) ? !n->a->num : n->a->num)) {
+    v = (n->op == ARITH_LOR);
+  } else if (n->op == ARITH_VAR || n->op == ARITH_ASSIGN || n->op == ARITH_COND ||
+             (n->a != NULL && n->a->op != ARITH_NUM) ||
+             (n->b != NULL && n->b->op != ARITH_NUM)) {
+    return n;
+  } else if (arith_eval_node(n, &v) != 0) {
+    return n;
+  }
+
+  arith_node_free(n->a);
+  arith_node_free(n->b);
+  n->a = n->b = NULL;
+  n->op = ARITH_NUM;
+  n->num = v;
+  return n;
+}
+
+static struct arith_node *arith_make(enum arith_op op, struct arith_node *a,
+                                     struct arith_node *b)
+{
+  struct arith_node *n = arith_node_new(op);
+
+  n->a = a;
+  n->b = b;
+  return arith_fold(n);
+}
+
+static struct arith_node *arith_parse_primary(struct arith_parser *ps)
+{
+  struct arith_node *n;
+  const char *start;
+
+  arith_skip_space(ps);
+  if (arith_accept(ps, "(")) {
+    n = arith_parse_assign(ps);
+    if (n == NULL) {
+      return NULL;
+    }
+    if (!arith_accept(ps, ")")) {
+      ps->err = "missing )";
+      arith_node_free(n);
+      return NULL;
+    }
+    return n;
+  }
+
+  if (*ps->p >= '0' && *ps->p <= '9') {
+    n = arith_node_new(ARITH_NUM);
+    if (arith_parse_number(&ps->p, &n->num) != 0) {
+      ps->err = "invalid number";
+      free(n);
+      return NULL;
+    }
+    return n;
+  }
+
+  if (*ps->p == '$') {
+    ps->p++;
+  }
+  start = ps->p;
+  while (*ps->p == '_' || (*ps->p >= 'a' && *ps->p <= 'z') ||
+         (*ps->p >= 'A' && *ps->p <= 'Z') ||
+         (ps->p != start && *ps->p >= '0' && *ps->p <= '9')) {
+    ps->p++;
+  }
+  if (ps->p == start) {
+    ps->err = (*ps->p == '\0') ? "missing operand" : "syntax error";
+    return NULL;
+  }
+  n = arith_node_new(ARITH_VAR);
+  n->var = soshell_var_lookup(start, ps->p - start, 1);
+  return n;
+}
+
+static struct arith_node *arith_parse_unary(struct arith_parser *ps)
+{
+  const char *op = arith_peek(ps);
+  enum arith_op kind;
+  struct arith_node *a;
+
+  if (op == NULL || op[1] != '\0' || strchr("+-!~", op[0]) == NULL) {
+    return arith_parse_primary(ps);
+  }
+  ps->p++;
+  kind = (op[0] == '+') ? ARITH_POS : (op[0] == '-') ? ARITH_NEG :
+         (op[0] == '!') ? ARITH_NOT : ARITH_BNOT;
+  a = arith_parse_unary(ps);
+  if (a == NULL) {
+    return NULL;
+  }
+  return arith_make(kind, a, NULL);
+}
+
+/*
+  Binary operator levels, from tightest to loosest binding.
+ */
+struct arith_level {
+  const char *ops[5];
+  enum arith_op kinds[4];
+};
+
+static const struct arith_level arith_levels[] = {
+  { { "*", "/", "%", NULL }, { ARITH_MUL, ARITH_DIV, ARITH_MOD } },
+  { { "+", "-", NULL }, { ARITH_ADD, ARITH_SUB } },
+  { { "<<", ">>", NULL }, { ARITH_SHL, ARITH_SHR } },
+  { { "<", "<=", ">", ">=", NULL }, { ARITH_LT, ARITH_LE, ARITH_GT, ARITH_GE } },
+  { { "==", "!=", NULL }, { ARITH_EQ, ARITH_NE } },
+  { { "&", NULL }, { ARITH_BAND } },
+  { { "^", NULL }, { ARITH_BXOR } },
+  { { "|", NULL }, { ARITH_BOR } },
+  { { "&&", NULL }, { ARITH_LAND } },
+  { { "||", NULL }, { ARITH_LOR } },
+};
+
+#define ARITH_NUM_LEVELS ((int)(sizeof(arith_levels) / sizeof(arith_levels[0])))
+
+static struct arith_node *arith_parse_binary(struct arith_parser *ps, int level)
+{
+  struct arith_node *lhs, *rhs;
+  const char *op;
+  int i;
+
+  if (level < 0) {
+    return arith_parse_unary(ps);
+  }
+  lhs = arith_parse_binary(ps, level - 1);
+  while (lhs != NULL) {
+    op = arith_peek(ps);
+    for (i = 0; op != NULL && arith_levels[level].ops[i] != NULL; i++) {
+      if (strcmp(op, arith_levels[level].ops[i]) == 0) {
+        break;
+      }
+    }
+    if (op == NULL || arith_levels[level].ops[i] == NULL) {
+      break;
+    }
+    ps->p += strlen(op);
+    rhs = arith_parse_binary(ps, level - 1);
+    if (rhs == NULL) {
+      arith_node_free(lhs);
+      return NULL;
+    }
+    lhs = arith_make(arith_levels[level].kinds[i], lhs, rhs);
+  }
+  return lhs;
+}
+
+static struct arith_node *arith_parse_cond(struct arith_parser *ps)
+{
+  struct arith_node *n, *cond = arith_parse_binary(ps, ARITH_NUM_LEVELS - 1);
+
+  if (cond == NULL || !arith_accept(ps, "?")) {
+    return cond;
+  }
+  n = arith_node_new(ARITH_COND);
+  n->a = cond;
+  n->b = arith_parse_assign(ps);
+  if (n->b != NULL && !arith_accept(ps, ":")) {
+    ps->err = "missing :";
+  } else if (n->b != NULL) {
+    n->c = arith_parse_cond(ps);
+  }
+  if (n->b == NULL || n->c == NULL) {
+    arith_node_free(n);
+    return NULL;
+  }
+  return arith_fold(n);
+}
+
+static struct arith_node *arith_parse_assign(struct arith_parser *ps)
+{
+  static const char *assign_ops[] = {
+    "=", "*=", "/=", "%=", "+=", "-=", "<<=", ">>=", "&=", "^=", "|=", NULL
+  };
+  static const enum arith_op assign_kinds[] = {
+    ARITH_NUM, ARITH_MUL, ARITH_DIV, ARITH_MOD, ARITH_ADD, ARITH_SUB,
+    ARITH_SHL, ARITH_SHR, ARITH_BAND, ARITH_BXOR, ARITH_BOR
+  };
+  struct arith_node *lhs = arith_parse_cond(ps);
+  struct arith_node *n;
+  const char *op;
+  int i;
+
+  if (lhs == NULL || lhs->op != ARITH_VAR || (op = arith_peek(ps)) == NULL) {
+    return lhs;
+  }
+  for (i = 0; assign_ops[i] != NULL; i++) {
+    if (strcmp(op, assign_ops[i]) == 0) {
+      break;
+    }
+  }
+  if (assign_ops[i] == NULL) {
+    return lhs;
+  }
+  ps->p += strlen(op);
+  n = arith_node_new(ARITH_ASSIGN);
+  n->assign_op = assign_kinds[i];
+  n->var = lhs->var;
+  free(lhs);
+  n->b = arith_parse_assign(ps);
+  if (n->b == NULL) {
+    free(n);
+    return NULL;
+  }
+  return n;
+}
+
+static struct arith_node *arith_parse(const char *expr, const char **err)
+{
+  struct arith_parser ps;
+  struct arith_node *n;
+
+  ps.p = expr;
+  ps.err = NULL;
+  n = arith_parse_assign(&ps);
+  if (n != NULL) {
+    arith_skip_space(&ps);
+    if (*ps.p != '\0') {
+      ps.err = "syntax error";
+      arith_node_free(n);
+      n = NULL;
+    }
+  }
+  *err = ps.err ? ps.err : "syntax error";
+  return n;
+}
+
+/*
+  Parsed expression cache, direct mapped on the hash of the text.
+ */
+#define ARITH_CACHE_SIZE 256
+
+struct arith_cache_entry {
+  char *text;
+  struct arith_node *root;
+};
+
+static struct arith_cache_entry arith_cache[ARITH_CACHE_SIZE];
+
+static struct arith_node *arith_compile(const char *expr, const char **err)
+{
+  unsigned long h = 5381;
+  const char *s;
+  struct arith_cache_entry *ent;
+  struct arith_node *root;
+
+  for (s = expr; *s; s++) {
+    h = h * 33 + (unsigned char)*s;
+  }
+  ent = &arith_cache[h % ARITH_CACHE_SIZE];
+  if (ent->text != NULL && strcmp(ent->text, expr) == 0) {
+    return ent->root;
+  }
+
+  root = arith_parse(expr, err);
+  if (root == NULL) {
+    return NULL;
+  }
+  free(ent->text);
+  arith_node_free(ent->root);
+  ent->text = strdup(expr);
+  ent->root = root;
+  if (ent->text == NULL) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return root;
+}
+
+/**
+   @brief Evaluate an arithmetic expression.
+   @param expr The expression text.
+   @param result Where to store the value.
+   @return 0 on success, -1 (after printing a message) on error.
+ */
+int soshell_arith_eval(const char *expr, int64_t *result)
+{
+  const char *err;
+  struct arith_node *root = arith_compile(expr, &err);
+
+  if (root == NULL) {
+    fprintf(stderr, "soshell: arithmetic: %s: \"%s\"\n", err, expr);
+    return -1;
+  }
+  arith_err = NULL;
+  if (arith_eval_node(root, result) != 0) {
+    fprintf(stderr, "soshell: arithmetic: %s: \"%s\"\n", arith_err, expr);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+  Find the "))" closing an expansion whose text starts at s.
+ */
+static const char *arith_find_end(const char *s)
+{
+  int depth = 0;
+
+  for (; *s; s++) {
+    if (*s == '(') {
+      depth++;
+    } else if (*s == ')') {
+      if (depth == 0) {
+        return (s[1] == ')') ? s : NULL;
+      }
+      depth--;
+    }
+  }
+  return NULL;
+}
+
+/**
+   @brief Replace every $(( expr )) in a line with its value.
+   @param line Pointer to a malloc'd line; replaced by a new line when
+   anything was expanded.
+   @return 0 on success, -1 (after printing a message) on error.
+ */
+int soshell_arith_expand(char **line)
+{
+  char *in = *line, *out, *expr, *start, *end;
+  size_t len, pos = 0, cap;
+  int64_t value;
+  char num[32];
+  int n;
+
+  start = strstr(in, "$((");
+  if (start == NULL) {
+    return 0;
+  }
+
+  cap = strlen(in) + 64;
+  out = malloc(cap);
+  if (out == NULL) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+
+  while (start != NULL) {
+    end = (char *)arith_find_end(start + 3);
+    if (end == NULL) {
+      fprintf(stderr, "soshell: arithmetic: missing ))\n");
+      free(out);
+      return -1;
+    }
+
+    expr = strndup(start + 3, end - (start + 3));
+    if (expr == NULL) {
+      fprintf(stderr, "soshell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+    // Nested expansions are expanded first.
+    if (soshell_arith_expand(&expr) != 0 || soshell_arith_eval(expr, &value) != 0) {
+      free(expr);
+      free(out);
+      return -1;
+    }
+    free(expr);
+
+    n = snprintf(num, sizeof(num), "%" PRId64, value);
+    len = start - in;
+    if (pos + len + n + strlen(end + 2) + 1 > cap) {
+      cap = pos + len + n + strlen(end + 2) + 64;
+      out = realloc(out, cap);
+      if (out == NULL) {
+        fprintf(stderr, "soshell: allocation error\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    memcpy(out + pos, in, len);
+    pos += len;
+    memcpy(out + pos, num, n);
+    pos += n;
+
+    in = end + 2;
+    start = strstr(in, "$((");
+  }
+  strcpy(out + pos, in);
+
+  free(*line);
+  *line = out;
+  return 0;
+}
@@ -0,0 +1,9 @@
+#ifndef SOSHELL_ARITH_H
+#define SOSHELL_ARITH_H
+
+#include <stdint.h>
+
+int soshell_arith_eval(const char *expr, int64_t *result);
+int soshell_arith_expand(char **line);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef SOSHELL_BUILTIN_H
+#define SOSHELL_BUILTIN_H
+
+typedef int (*soshell_builtin_fn)(char **args);
+
+soshell_builtin_fn soshell_find_builtin(const char *name);
+int soshell_builtin_changes_shell(const char *name);
+int soshell_execute(char **args);
+
+#endif
@@ -0,0 +1,186 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include "cat.h"
+#include "io.h"
+#include "job.h"
+
+/*
+  cat, without a fork.
+
+  Data is moved by the kernel whenever the descriptor types allow it:
+  copy_file_range between regular files, sendfile from a regular file
+  to anything else, splice when either side is a pipe.  Each of these
+  refuses some combinations (EINVAL, EXDEV, ...) before moving any
+  data, in which case the next method is tried, down to a plain
+  read/write loop with a large buffer.
+
+  In a background job the output does not block (see job.c): EAGAIN
+  waits for it to drain, letting the shell run meanwhile.
+ */
+
+#define CAT_CHUNK (1L << 30)
+#define CAT_SPLICE_CHUNK (1L << 20)
+#define CAT_BUFSIZE (256 * 1024)
+
+enum cat_method {
+  CAT_COPY_FILE_RANGE,
+  CAT_SENDFILE,
+  CAT_SPLICE
+};
+
+/*
+  Move data with one of the zero-copy calls.  Returns 0 at end of
+  input, -1 with errno set on failure, or 1 if the method is not
+  supported for these descriptors (nothing has been moved).
+ */
+static int cat_zero_copy(enum cat_method method, int in, int out)
+{
+  int moved = 0;
+  ssize_t n;
+
+  for (;;) {
+    if (method == CAT_COPY_FILE_RANGE) {
+      n = copy_file_range(in, NULL, out, NULL, CAT_CHUNK, 0);
+    } else if (method == CAT_SENDFILE) {
+      n = sendfile(out, in, NULL, CAT_CHUNK);
+    } else {
+      n = splice(in, NULL, out, NULL, CAT_SPLICE_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+    }
+    if (n > 0) {
+      moved = 1;
+      soshell_job_yield();
+      continue;
+    }
+    if (n == 0) {
+      // Files of /proc and the like stat as regular and empty, and
+      // copy_file_range finds nothing in them: leave them to sendfile.
+      return (method == CAT_COPY_FILE_RANGE && !moved) ? 1 : 0;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno == EAGAIN) {
+      soshell_job_wait_fd(out, POLLOUT);
+      continue;
+    }
+    if (!moved && (errno == EINVAL || errno == ENOSYS || errno == EXDEV ||
+                   errno == EBADF || errno == EOPNOTSUPP || errno == ESPIPE)) {
+      return 1;
+    }
+    return -1;
+  }
+}
+
+static int cat_read_write(int in, int out)
+{
+  char *buf = malloc(CAT_BUFSIZE);
+  ssize_t n, done, w;
+
+  if (!buf) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  for (;;) {
+    n = read(in, buf, CAT_BUFSIZE);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      free(buf);
+      return (int)n;
+    }
+    for (done = 0; done < n; done += w) {
+      w = write(out, buf + done, n - done);
+      if (w < 0 && errno == EINTR) {
+        w = 0;
+      } else if (w < 0 && errno == EAGAIN) {
+        soshell_job_wait_fd(out, POLLOUT);
+        w = 0;
+      } else if (w < 0) {
+        free(buf);
+        return -1;
+      }
+    }
+    soshell_job_yield();
+  }
+}
+
+/**
+   @brief Copy everything from one descriptor to another, as fast as
+   the descriptor types allow.
+   @param in Source, read from its current position.
+   @param out Destination, written at its current position.
+   @return 0 on success, -1 with errno set on failure.
+ */
+int soshell_copy_fd(int in, int out)
+{
+  struct stat ist, ost;
+  int ret = 1;
+
+  if (fstat(in, &ist) != 0 || fstat(out, &ost) != 0) {
+    return -1;
+  }
+  if (S_ISREG(ist.st_mode) && S_ISREG(ost.st_mode)) {
+    ret = cat_zero_copy(CAT_COPY_FILE_RANGE, in, out);
+  }
+  if (ret == 1 && S_ISREG(ist.st_mode)) {
+    ret = cat_zero_copy(CAT_SENDFILE, in, out);
+  }
+  if (ret == 1 && (S_ISFIFO(ist.st_mode) || S_ISFIFO(ost.st_mode))) {
+    ret = cat_zero_copy(CAT_SPLICE, in, out);
+  }
+  if (ret == 1) {
+    ret = cat_read_write(in, out);
+  }
+  return ret;
+}
+
+/**
+   @brief Builtin command: concatenate files to standard output.
+   @param args List of args.  args[1..] are files; none or "-" means
+   standard input.
+   @return Always returns 1, to continue executing.
+ */
+int soshell_cat(char **args)
+{
+  int out, in, i, err;
+  char *none[] = { "-", NULL };
+  char **files = (args[1] == NULL) ? none : args + 1;
+
+  // Whatever the builtin printed so far goes first.
+  soshell_out_flush();
+  out = soshell_out_current()->fd;
+
+  for (i = 0; files[i] != NULL; i++) {
+    if (strcmp(files[i], "-") == 0) {
+      in = soshell_in_fd;
+    } else {
+      in = open(files[i], O_RDONLY | O_CLOEXEC);
+      if (in < 0) {
+        fprintf(stderr, "soshell: cat: %s: %s\n", files[i], strerror(errno));
+        continue;
+      }
+    }
+    err = (soshell_copy_fd(in, out) != 0) ? errno : 0;
+    if (in != soshell_in_fd) {
+      close(in);
+    }
+    if (err == EPIPE) {
+      // Nobody is reading any more.
+      break;
+    }
+    if (err != 0) {
+      fprintf(stderr, "soshell: cat: %s: %s\n", files[i], strerror(err));
+    }
+  }
+  return 1;
+}
@@ -0,0 +1,7 @@
+#ifndef SOSHELL_CAT_H
+#define SOSHELL_CAT_H
+
+int soshell_cat(char **args);
+int soshell_copy_fd(int in, int out);
+
+#endif
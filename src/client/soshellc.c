@@ -0,0 +1,161 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "daemon.h"
+
+/*
+  soshellc [soshell arguments]
+
+  Thin client of soshell --daemon: hands its arguments, environment,
+  directory and standard descriptors to the daemon, which runs them in
+  a warm copy of the shell, and exits with the shell's status.
+  SIGINT, SIGTERM and SIGHUP are passed on to the run; if it ends
+  without a status, the client dies of the signal it was sent.  When no
+  daemon is listening it runs soshell itself, so it can stand in for
+  soshell unconditionally.
+ */
+
+extern char **environ;
+
+static int client_sock = -1;
+static volatile sig_atomic_t client_signal;
+
+static void client_forward(int sig)
+{
+  unsigned char byte = sig;
+
+  client_signal = sig;
+  send(client_sock, &byte, 1, MSG_NOSIGNAL);
+}
+
+static int client_write_full(int fd, const char *p, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0) {
+    n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int client_connect(void)
+{
+  struct sockaddr_un addr;
+  int sock;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  soshell_daemon_path(addr.sun_path, sizeof(addr.sun_path));
+  sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock >= 0 && connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(sock);
+    sock = -1;
+  }
+  return sock;
+}
+
+int main(int argc, char **argv)
+{
+  char control[CMSG_SPACE(SOSHELL_DAEMON_NFDS * sizeof(int))];
+  int fds[SOSHELL_DAEMON_NFDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, -1 };
+  struct soshell_daemon_request req;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct sigaction sa;
+  struct iovec iov;
+  char *strings, *p;
+  size_t len = 0;
+  int32_t status;
+  int sock, i;
+  ssize_t n;
+
+  sock = client_connect();
+  fds[3] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (sock < 0 || fds[3] < 0) {
+    argv[0] = "soshell";
+    execvp(argv[0], argv);
+    perror("soshellc");
+    return 127;
+  }
+
+  for (i = 0; i < argc; i++) {
+    len += strlen(argv[i]) + 1;
+  }
+  for (i = 0; environ[i] != NULL; i++) {
+    len += strlen(environ[i]) + 1;
+  }
+  req.argc = argc;
+  req.envc = i;
+  req.len = len;
+  req.umask = umask(0);
+  umask(req.umask);
+  p = strings = malloc(len);
+  if (!strings) {
+    fprintf(stderr, "soshellc: allocation error\n");
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < argc; i++) {
+    p = stpcpy(p, argv[i]) + 1;
+  }
+  for (i = 0; environ[i] != NULL; i++) {
+    p = stpcpy(p, environ[i]) + 1;
+  }
+
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  iov.iov_base = &req;
+  iov.iov_len = sizeof(req);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(req) ||
+      client_write_full(sock, strings, len) < 0) {
+    perror("soshellc");
+    return EXIT_FAILURE;
+  }
+  // The descriptors now belong to the daemon's run as well.
+  close(fds[3]);
+
+  client_sock = sock;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = client_forward;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+  do {
+    n = read(sock, &status, sizeof(status));
+  } while (n < 0 && errno == EINTR);
+  if (n == sizeof(status)) {
+    return status;
+  }
+  if (client_signal != 0) {
+    signal(client_signal, SIG_DFL);
+    raise(client_signal);
+  }
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,426 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include "cp.h"
+#include "cat.h"
+#include "pool.h"
+
+/*
+  cp [-r] [-p] source... dest
+
+  Each regular file is cloned with FICLONE where the file system can
+  share extents, and copied with copy_file_range otherwise, falling
+  back to soshell_copy_fd.  For -r the tree is walked on the calling thread, which
+  creates every directory before queueing the files inside it, and the
+  file copies run concurrently on a worker pool.  Directory modes and
+  times are applied last, deepest first, so that populating a
+  directory neither fails on a read-only mode nor bumps a preserved
+  mtime.
+ */
+
+#define CP_MIN_WORKERS 4
+#define CP_CHUNK (1L << 30)
+
+struct cp_opts {
+  int recursive;
+  int preserve;
+  mode_t umask;
+  dev_t top_dev;           /* top destination directory, not to be copied into itself */
+  ino_t top_ino;
+  struct soshell_pool *pool;
+  struct cp_dir *dirs;
+  atomic_ulong noclone_dev;  /* 1 + source device that refused FICLONE, or 0 */
+};
+
+struct cp_job {
+  char *src;
+  char *dst;
+  struct stat st;
+  struct cp_opts *opts;
+};
+
+/* Directory whose final mode and times are set once its contents are in. */
+struct cp_dir {
+  char *path;
+  struct stat st;
+  struct cp_dir *next;
+};
+
+static void cp_error(const char *path)
+{
+  fprintf(stderr, "soshell: cp: %s: %s\n", path, strerror(errno));
+}
+
+static void cp_preserve(int fd, const char *path, const struct stat *st)
+{
+  struct timespec times[2];
+
+  // Ownership is kept when allowed; an unprivileged cp cannot give files away.
+  if (fchown(fd, st->st_uid, st->st_gid) != 0 && errno != EPERM) {
+    cp_error(path);
+  }
+  if (fchmod(fd, st->st_mode & 07777) != 0) {
+    cp_error(path);
+  }
+  times[0] = st->st_atim;
+  times[1] = st->st_mtim;
+  if (futimens(fd, times) != 0) {
+    cp_error(path);
+  }
+}
+
+/*
+  Copy until copy_file_range reports end of file: the size stat()
+  gave may be out of date, and files such as those of /proc stat as
+  empty.  Returns 0 on success and -1 on failure; 1 means nothing was
+  copied and the copy is better done another way.
+ */
+static int cp_copy_range(int in, int out)
+{
+  ssize_t n;
+  int moved = 0;
+
+  for (;;) {
+    n = copy_file_range(in, NULL, out, NULL, CP_CHUNK, 0);
+    if (n > 0) {
+      moved = 1;
+      continue;
+    }
+    if (n == 0) {
+      return moved ? 0 : 1;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (!moved && (errno == EINVAL || errno == EXDEV || errno == ENOSYS ||
+                   errno == EOPNOTSUPP)) {
+      return 1;
+    }
+    return -1;
+  }
+}
+
+static void cp_file(struct cp_opts *opts, const char *src, const char *dst,
+                    const struct stat *st)
+{
+  unsigned long noclone = (unsigned long)st->st_dev + 1;
+  int in, out, ret = 1;
+
+  in = open(src, O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    cp_error(src);
+    return;
+  }
+  // The copy is ours: set-ID bits only come back with -p, in cp_preserve().
+  out = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st->st_mode & 0777);
+  if (out < 0) {
+    cp_error(dst);
+    close(in);
+    return;
+  }
+  // Once a file system refuses FICLONE, its other files go straight to copying.
+  if (st->st_size > 0 &&
+      atomic_load_explicit(&opts->noclone_dev, memory_order_relaxed) != noclone) {
+    if (ioctl(out, FICLONE, in) == 0) {
+      ret = 0;
+    } else if (errno == EOPNOTSUPP || errno == ENOTTY || errno == EINVAL) {
+      atomic_store_explicit(&opts->noclone_dev, noclone, memory_order_relaxed);
+    }
+  }
+  if (ret == 1) {
+    ret = cp_copy_range(in, out);
+  }
+  if (ret == 1) {
+    ret = soshell_copy_fd(in, out);
+  }
+  if (ret != 0) {
+    cp_error(dst);
+  } else if (opts->preserve) {
+    cp_preserve(out, dst, st);
+  }
+  close(out);
+  close(in);
+}
+
+static void cp_job_run(void *arg)
+{
+  struct cp_job *job = arg;
+
+  cp_file(job->opts, job->src, job->dst, &job->st);
+  free(job->src);
+  free(job->dst);
+  free(job);
+}
+
+static void cp_symlink(const char *src, const char *dst)
+{
+  char target[PATH_MAX];
+  ssize_t n = readlink(src, target, sizeof(target) - 1);
+
+  if (n < 0) {
+    cp_error(src);
+    return;
+  }
+  target[n] = '\0';
+  if (symlink(target, dst) != 0) {
+    cp_error(dst);
+  }
+}
+
+static char *cp_strdup(const char *s)
+{
+  char *copy = strdup(s);
+
+  if (!copy) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return copy;
+}
+
+static char *cp_join(const char *dir, const char *name)
+{
+  size_t dlen = strlen(dir), nlen = strlen(name);
+  char *path = malloc(dlen + nlen + 2);
+
+  if (!path) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(path, dir, dlen);
+  path[dlen] = '/';
+  memcpy(path + dlen + 1, name, nlen + 1);
+  return path;
+}
+
+static void cp_tree(struct cp_opts *opts, const char *src, char *dst, const struct stat *st);
+
+/*
+  Copy one entry of a tree walk.  Takes ownership of dst.
+ */
+static void cp_entry(struct cp_opts *opts, const char *src, char *dst, const struct stat *st)
+{
+  struct cp_job *job;
+
+  if (S_ISDIR(st->st_mode)) {
+    cp_tree(opts, src, dst, st);
+    return;
+  }
+  if (S_ISREG(st->st_mode)) {
+    job = malloc(sizeof(*job));
+    if (!job) {
+      fprintf(stderr, "soshell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+    job->src = cp_strdup(src);
+    job->dst = dst;
+    job->st = *st;
+    job->opts = opts;
+    soshell_pool_submit(opts->pool, cp_job_run, job);
+    return;
+  }
+  if (S_ISLNK(st->st_mode)) {
+    cp_symlink(src, dst);
+  } else {
+    fprintf(stderr, "soshell: cp: %s: not a regular file, skipped\n", src);
+  }
+  free(dst);
+}
+
+static void cp_tree(struct cp_opts *opts, const char *src, char *dst, const struct stat *st)
+{
+  struct cp_dir *dir;
+  struct dirent *ent;
+  struct stat est, dst_st;
+  char *esrc;
+  DIR *d;
+
+  // Writable while it is being filled; the real mode comes at the end.
+  if (mkdir(dst, (st->st_mode & 07777) | S_IRWXU) != 0 &&
+      (errno != EEXIST || stat(dst, &dst_st) != 0 || !S_ISDIR(dst_st.st_mode))) {
+    cp_error(dst);
+    free(dst);
+    return;
+  }
+  if (opts->top_ino == 0 && stat(dst, &dst_st) == 0) {
+    opts->top_dev = dst_st.st_dev;
+    opts->top_ino = dst_st.st_ino;
+  }
+
+  dir = malloc(sizeof(*dir));
+  if (!dir) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  dir->path = dst;
+  dir->st = *st;
+  dir->next = opts->dirs;
+  opts->dirs = dir;
+
+  d = opendir(src);
+  if (d == NULL) {
+    cp_error(src);
+    return;
+  }
+  while ((ent = readdir(d)) != NULL) {
+    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+      continue;
+    }
+    if (fstatat(dirfd(d), ent->d_name, &est, AT_SYMLINK_NOFOLLOW) != 0) {
+      esrc = cp_join(src, ent->d_name);
+      cp_error(esrc);
+      free(esrc);
+      continue;
+    }
+    if (est.st_dev == opts->top_dev && est.st_ino == opts->top_ino) {
+      fprintf(stderr, "soshell: cp: cannot copy a directory into itself\n");
+      continue;
+    }
+    esrc = cp_join(src, ent->d_name);
+    cp_entry(opts, esrc, cp_join(dst, ent->d_name), &est);
+    free(esrc);
+  }
+  closedir(d);
+}
+
+/*
+  Apply final directory modes and times.  The list is in reverse order
+  of creation, so children come before their parents.
+ */
+static void cp_finish_dirs(struct cp_opts *opts)
+{
+  struct cp_dir *dir, *next;
+  struct timespec times[2];
+
+  for (dir = opts->dirs; dir != NULL; dir = next) {
+    next = dir->next;
+    if (opts->preserve) {
+      if (lchown(dir->path, dir->st.st_uid, dir->st.st_gid) != 0 && errno != EPERM) {
+        cp_error(dir->path);
+      }
+      if (chmod(dir->path, dir->st.st_mode & 07777) != 0) {
+        cp_error(dir->path);
+      }
+      times[0] = dir->st.st_atim;
+      times[1] = dir->st.st_mtim;
+      if (utimensat(AT_FDCWD, dir->path, times, 0) != 0) {
+        cp_error(dir->path);
+      }
+    } else if ((dir->st.st_mode & S_IRWXU) != S_IRWXU &&
+               chmod(dir->path, dir->st.st_mode & 01777 & ~opts->umask) != 0) {
+      cp_error(dir->path);
+    }
+    free(dir->path);
+    free(dir);
+  }
+  opts->dirs = NULL;
+}
+
+static const char *cp_basename(const char *path)
+{
+  const char *end = path + strlen(path), *slash;
+
+  while (end > path + 1 && end[-1] == '/') {
+    end--;
+  }
+  for (slash = end - 1; slash > path && slash[-1] != '/'; slash--) {}
+  return slash;
+}
+
+/**
+   @brief Builtin command: copy files and directory trees.
+   @param args List of args.  Options -r/-R and -p, then sources and
+   the destination.
+   @return Always returns 1, to continue executing.
+ */
+int soshell_cp(char **args)
+{
+  struct cp_opts opts;
+  struct stat st, dst_st;
+  char **files, *dst, *target;
+  const char *opt;
+  int i, n, into_dir, workers;
+
+  memset(&opts, 0, sizeof(opts));
+  atomic_init(&opts.noclone_dev, 0);
+  for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+    if (strcmp(args[i], "--") == 0) {
+      i++;
+      break;
+    }
+    for (opt = args[i] + 1; *opt; opt++) {
+      if (*opt == 'r' || *opt == 'R') {
+        opts.recursive = 1;
+      } else if (*opt == 'p') {
+        opts.preserve = 1;
+      } else {
+        fprintf(stderr, "soshell: cp: unknown option -%c\n", *opt);
+        return 1;
+      }
+    }
+  }
+  files = args + i;
+  for (n = 0; files[n] != NULL; n++) {}
+  if (n < 2) {
+    fprintf(stderr, "soshell: cp: expected source and destination\n");
+    return 1;
+  }
+  dst = files[n - 1];
+  into_dir = (n > 2) || (stat(dst, &dst_st) == 0 && S_ISDIR(dst_st.st_mode));
+  if (n > 2 && !into_dir) {
+    fprintf(stderr, "soshell: cp: %s: not a directory\n", dst);
+    return 1;
+  }
+
+  opts.umask = umask(0);
+  umask(opts.umask);
+
+  for (i = 0; i < n - 1; i++) {
+    if (stat(files[i], &st) != 0) {
+      cp_error(files[i]);
+      continue;
+    }
+    target = into_dir ? cp_join(dst, cp_basename(files[i])) : cp_strdup(dst);
+    if (stat(target, &dst_st) == 0 && dst_st.st_dev == st.st_dev && dst_st.st_ino == st.st_ino) {
+      fprintf(stderr, "soshell: cp: %s and %s are the same file\n", files[i], target);
+      free(target);
+      continue;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+      if (!opts.recursive) {
+        fprintf(stderr, "soshell: cp: -r not specified; omitting directory %s\n", files[i]);
+        free(target);
+        continue;
+      }
+      if (opts.pool == NULL) {
+        // Copies mostly wait on I/O, so use a few workers even on small machines.
+        workers = soshell_ncpus();
+        opts.pool = soshell_pool_create(workers < CP_MIN_WORKERS ? CP_MIN_WORKERS : workers);
+      }
+      opts.top_ino = 0;
+      cp_tree(&opts, files[i], target, &st);
+      soshell_pool_wait(opts.pool);
+      cp_finish_dirs(&opts);
+    } else {
+      cp_file(&opts, files[i], target, &st);
+      free(target);
+    }
+  }
+
+  if (opts.pool != NULL) {
+    soshell_pool_destroy(opts.pool);
+  }
+  return 1;
+}
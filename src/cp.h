@@ -0,0 +1,6 @@
+#ifndef SOSHELL_CP_H
+#define SOSHELL_CP_H
+
+int soshell_cp(char **args);
+
+#endif
@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "daemon.h"
+#include "io.h"
+#include "shell.h"
+
+/*
+  soshell --daemon [socket]
+
+  Serves soshellc on a Unix socket, so tools that run "soshell -c" over
+  and over do not pay for exec, dynamic linking and the shell's setup
+  each time.  Every client is served by a copy of the daemon, already
+  initialized and with its caches warm; the copy takes the client's
+  descriptors, directory and environment, runs the client's arguments
+  as soshell would, and sends back the exit status.
+
+  The copies are forked ahead of time: DAEMON_SPARES of them wait in
+  accept(), and report over a socket pair when they take a client and
+  when they are done with it, so the daemon can fork replacements off
+  the client's path.
+
+  A run is a process group of its own.  A signal the client forwards
+  goes to the whole group, and a client that goes away before the run
+  is over hangs it up, so that nothing keeps running on its behalf.
+
+  Only clients of the daemon's own user are served.  Workers write to
+  the client and to the daemon with send(MSG_NOSIGNAL): either one
+  going away must not kill a worker with SIGPIPE.
+ */
+
+#define DAEMON_SPARES 2
+
+extern char **environ;
+
+static int daemon_read_full(int fd, void *buf, size_t len)
+{
+  char *p = buf;
+  ssize_t n;
+
+  while (len > 0) {
+    n = read(fd, p, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/*
+  Send one byte, or the status, without SIGPIPE.  A peer that is gone
+  is not waiting for it.
+ */
+static void daemon_send(int fd, const void *buf, size_t len)
+{
+  while (send(fd, buf, len, MSG_NOSIGNAL) < 0 && errno == EINTR) {}
+}
+
+/*
+  Receive the request and take over the client's descriptors and
+  directory.  Fills argv and envp, which point into one allocation.
+ */
+static int daemon_receive(int conn, char ***argv, int *argc)
+{
+  char control[CMSG_SPACE(SOSHELL_DAEMON_NFDS * sizeof(int))];
+  struct soshell_daemon_request req;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+  int fds[SOSHELL_DAEMON_NFDS], i;
+  char *strings, *p, **vec;
+  ssize_t n;
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = &req;
+  iov.iov_len = sizeof(req);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  do {
+    n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if (n != sizeof(req) || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(fds)) || req.argc == 0) {
+    return -1;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+  strings = malloc(req.len);
+  vec = malloc((req.argc + req.envc + 2) * sizeof(char *));
+  if (!strings || !vec) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  if (req.len == 0 || daemon_read_full(conn, strings, req.len) < 0 ||
+      strings[req.len - 1] != '\0') {
+    return -1;
+  }
+  p = strings;
+  for (i = 0; i < (int)(req.argc + req.envc); i++) {
+    if (p >= strings + req.len) {
+      return -1;
+    }
+    // argv, a NULL, then the environment.
+    vec[i + (i >= (int)req.argc)] = p;
+    p += strlen(p) + 1;
+  }
+  vec[req.argc] = NULL;
+  vec[req.argc + 1 + req.envc] = NULL;
+
+  for (i = 0; i < 3; i++) {
+    dup2(fds[i], i);
+    close(fds[i]);
+  }
+  if (fchdir(fds[3]) != 0) {
+    perror("soshell");
+  }
+  close(fds[3]);
+  umask(req.umask & 0777);
+  environ = vec + req.argc + 1;
+  *argv = vec;
+  *argc = req.argc;
+  return 0;
+}
+
+/* Set once the run is over, when the client may close the connection. */
+static atomic_int daemon_run_over;
+
+/*
+  Thread of a worker: pass the signals the client forwards on to the
+  run, and hang it up if the client disappears.
+ */
+static void *daemon_watch(void *arg)
+{
+  int conn = (int)(intptr_t)arg;
+  unsigned char sig;
+  ssize_t n;
+
+  for (;;) {
+    n = read(conn, &sig, 1);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n == 1) {
+      if (sig == SIGINT || sig == SIGTERM || sig == SIGHUP) {
+        kill(0, sig);
+      }
+      continue;
+    }
+    if (!atomic_load(&daemon_run_over)) {
+      kill(0, SIGHUP);
+    }
+    return NULL;
+  }
+}
+
+/*
+  In the forked copy: run one client and exit.
+ */
+static void daemon_serve(int conn, int ready)
+{
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  pthread_t watcher;
+  char **argv;
+  int argc;
+  int32_t status = 1;
+
+  signal(SIGCHLD, SIG_DFL);
+  if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 ||
+      cred.uid != getuid() || daemon_receive(conn, &argv, &argc) != 0) {
+    _exit(EXIT_FAILURE);
+  }
+  setpgid(0, 0);
+  if (pthread_create(&watcher, NULL, daemon_watch, (void *)(intptr_t)conn) == 0) {
+    pthread_detach(watcher);
+  }
+  status = soshell_run_args(argc, argv);
+  soshell_out_flush();
+  fflush(NULL);
+  atomic_store(&daemon_run_over, 1);
+  daemon_send(conn, &status, sizeof(status));
+  daemon_send(ready, "d", 1);
+  exit(status);
+}
+
+/*
+  A spare: wait for a client, tell the daemon, and serve it.
+ */
+static void daemon_worker(int sock, int ready)
+{
+  int conn;
+
+  do {
+    conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+  } while (conn < 0 && (errno == EINTR || errno == ECONNABORTED));
+  daemon_send(ready, "t", 1);
+  if (conn < 0) {
+    _exit(EXIT_FAILURE);
+  }
+  close(sock);
+  daemon_serve(conn, ready);
+}
+
+/**
+   @brief Serve soshellc clients until killed.
+   @param path Socket path, or NULL for the default.
+   @return Exit status, on failure to listen.
+ */
+int soshell_daemon(const char *path)
+{
+  struct sockaddr_un addr;
+  int sock, ready[2], spares = 0, want = DAEMON_SPARES;
+  ssize_t n;
+  mode_t mask;
+  pid_t pid;
+  char byte;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path != NULL) {
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+  } else {
+    soshell_daemon_path(addr.sun_path, sizeof(addr.sun_path));
+  }
+  sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0) {
+    perror("soshell: daemon");
+    return EXIT_FAILURE;
+  }
+  // A socket nobody answers on is left over from a daemon that died.
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+    fprintf(stderr, "soshell: daemon: already running on %s\n", addr.sun_path);
+    close(sock);
+    return EXIT_FAILURE;
+  }
+  unlink(addr.sun_path);
+  // The socket is created by bind(), for our user only.
+  mask = umask(077);
+  n = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+  umask(mask);
+  if (n != 0 || listen(sock, 64) != 0) {
+    fprintf(stderr, "soshell: daemon: %s: %s\n", addr.sun_path, strerror(errno));
+    close(sock);
+    return EXIT_FAILURE;
+  }
+  fprintf(stderr, "soshell: daemon listening on %s\n", addr.sun_path);
+
+  // Runs are reaped by the kernel; each reports its own status.
+  signal(SIGCHLD, SIG_IGN);
+
+  // A socket rather than a pipe, for send(MSG_NOSIGNAL).
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, ready) != 0) {
+    perror("soshell: daemon");
+    return EXIT_FAILURE;
+  }
+  for (;;) {
+    while (spares < want) {
+      soshell_out_flush();
+      pid = fork();
+      if (pid == 0) {
+        close(ready[0]);
+        daemon_worker(sock, ready[1]);
+      } else if (pid < 0) {
+        perror("soshell: daemon");
+        sleep(1);
+        continue;
+      }
+      spares++;
+    }
+    n = read(ready[0], &byte, 1);
+    if (n < 0 && errno != EINTR) {
+      perror("soshell: daemon");
+      return EXIT_FAILURE;
+    }
+    if (n != 1) {
+      continue;
+    }
+    /*
+      A spare took a client ('t'): replace it at once only if it was
+      the last one.  Otherwise wait until a run is done ('d'), so the
+      fork does not compete with it for the CPU.
+     */
+    if (byte == 't') {
+      spares--;
+      want = (spares == 0) ? DAEMON_SPARES : spares;
+    } else {
+      want = DAEMON_SPARES;
+    }
+  }
+}
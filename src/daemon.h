@@ -0,0 +1,50 @@
+#ifndef SOSHELL_DAEMON_H
+#define SOSHELL_DAEMON_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+  Wire format between soshell --daemon and the soshellc client, which
+  is built on its own and includes only this header.
+
+  The client sends a request header with sendmsg(), carrying as
+  SCM_RIGHTS its standard input, output and error and an O_PATH fd of
+  its current directory, then len bytes: argc arguments and envc
+  environment strings, each NUL terminated.  umask is the client's.
+  While the run lasts, the client sends one byte for each SIGINT,
+  SIGTERM or SIGHUP it receives: the signal number, for the daemon to
+  deliver to the run.  The daemon answers with the shell's exit status
+  as an int32_t when the run is over.
+ */
+#define SOSHELL_DAEMON_NFDS 4
+
+struct soshell_daemon_request {
+  uint32_t argc;
+  uint32_t envc;
+  uint32_t len;
+  uint32_t umask;
+};
+
+/*
+  The socket: $SOSHELL_SOCKET, else soshell.sock in $XDG_RUNTIME_DIR,
+  else /tmp/soshell-<uid>.sock.
+ */
+static inline void soshell_daemon_path(char *buf, size_t size)
+{
+  const char *env = getenv("SOSHELL_SOCKET"), *run = getenv("XDG_RUNTIME_DIR");
+
+  if (env != NULL && env[0] != '\0') {
+    snprintf(buf, size, "%s", env);
+  } else if (run != NULL && run[0] != '\0') {
+    snprintf(buf, size, "%s/soshell.sock", run);
+  } else {
+    snprintf(buf, size, "/tmp/soshell-%u.sock", (unsigned)getuid());
+  }
+}
+
+int soshell_daemon(const char *path);
+
+#endif
@@ -0,0 +1,273 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+
+#include "dircache.h"
+
+/*
+  Process-wide cache of directory listings, shared by ls and pathname
+  expansion.  Listings are keyed by (st_dev, st_ino) and checked against
+  the directory's mtime and ctime on every lookup, which costs one
+  stat() instead of open/getdents64/close.
+
+  A directory changed within the same second it was read cannot be
+  told apart from an unchanged one on file systems with coarse
+  timestamps, so such "racy" listings are never trusted and are read
+  again on the next lookup.
+ */
+
+#define DIRCACHE_BUCKETS 1024
+#define DIRCACHE_MAX_BYTES (16 * 1024 * 1024)
+#define DIRCACHE_READBUF (32 * 1024)
+
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+static struct soshell_dirlist *dircache_table[DIRCACHE_BUCKETS];
+static struct soshell_dirlist *dircache_lru_head, *dircache_lru_tail;
+static size_t dircache_bytes;
+// Builtins in a pipeline run on their own threads.
+static pthread_mutex_t dircache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long dircache_slot(dev_t dev, ino_t ino)
+{
+  uint64_t h = ((uint64_t)dev * 0x9e3779b97f4a7c15ULL) ^ (uint64_t)ino;
+
+  h ^= h >> 29;
+  return (unsigned long)(h % DIRCACHE_BUCKETS);
+}
+
+static void dircache_lru_unlink(struct soshell_dirlist *list)
+{
+  if (list->prev) {
+    list->prev->next = list->next;
+  } else {
+    dircache_lru_head = list->next;
+  }
+  if (list->next) {
+    list->next->prev = list->prev;
+  } else {
+    dircache_lru_tail = list->prev;
+  }
+  list->prev = list->next = NULL;
+}
+
+static void dircache_lru_push(struct soshell_dirlist *list)
+{
+  list->prev = NULL;
+  list->next = dircache_lru_head;
+  if (dircache_lru_head) {
+    dircache_lru_head->prev = list;
+  } else {
+    dircache_lru_tail = list;
+  }
+  dircache_lru_head = list;
+}
+
+static void dircache_free(struct soshell_dirlist *list)
+{
+  free(list->ents);
+  free(list->buf);
+  free(list);
+}
+
+static void dircache_put(struct soshell_dirlist *list)
+{
+  if (--list->refs == 0) {
+    dircache_free(list);
+  }
+}
+
+/*
+  Drop a listing from the cache; it is freed once its last user lets go.
+ */
+static void dircache_remove(struct soshell_dirlist *list)
+{
+  struct soshell_dirlist **pp = &dircache_table[dircache_slot(list->dev, list->ino)];
+
+  while (*pp != list) {
+    pp = &(*pp)->hnext;
+  }
+  *pp = list->hnext;
+  dircache_lru_unlink(list);
+  dircache_bytes -= list->bytes;
+  dircache_put(list);
+}
+
+static int dircache_fresh(const struct soshell_dirlist *list, const struct stat *st)
+{
+  return list->mtime.tv_sec == st->st_mtim.tv_sec &&
+         list->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+         list->ctime.tv_sec == st->st_ctim.tv_sec &&
+         list->ctime.tv_nsec == st->st_ctim.tv_nsec &&
+         list->filled > st->st_mtim.tv_sec && list->filled > st->st_ctim.tv_sec;
+}
+
+static struct soshell_dirlist *dircache_read(int fd, const struct stat *st)
+{
+  struct soshell_dirlist *list = calloc(1, sizeof(*list));
+  size_t cap = DIRCACHE_READBUF * 2, used = 0, pos, n = 0;
+  struct linux_dirent64 *d;
+  long nread;
+
+  if (list) {
+    list->buf = malloc(cap);
+  }
+  if (!list || !list->buf) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  // Take the time first: a change made while reading must look newer.
+  list->filled = time(NULL);
+
+  for (;;) {
+    if (cap - used < DIRCACHE_READBUF) {
+      cap *= 2;
+      list->buf = realloc(list->buf, cap);
+      if (!list->buf) {
+        fprintf(stderr, "soshell: allocation error\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    nread = syscall(SYS_getdents64, fd, list->buf + used, cap - used);
+    if (nread < 0) {
+      dircache_free(list);
+      return NULL;
+    }
+    if (nread == 0) {
+      break;
+    }
+    used += nread;
+  }
+
+  // Give back the slack; the cache is bounded by what it really holds.
+  list->buf = realloc(list->buf, used ? used : 1);
+  if (!list->buf) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  for (pos = 0; pos < used; pos += d->d_reclen) {
+    d = (struct linux_dirent64 *)(list->buf + pos);
+    n++;
+  }
+  list->ents = malloc((n ? n : 1) * sizeof(*list->ents));
+  if (!list->ents) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  for (pos = 0, n = 0; pos < used; pos += d->d_reclen, n++) {
+    d = (struct linux_dirent64 *)(list->buf + pos);
+    list->ents[n].name = d->d_name;
+    list->ents[n].type = d->d_type;
+  }
+
+  list->n = n;
+  list->dev = st->st_dev;
+  list->ino = st->st_ino;
+  list->mtime = st->st_mtim;
+  list->ctime = st->st_ctim;
+  list->bytes = used + n * sizeof(*list->ents);
+  list->refs = 1;
+  return list;
+}
+
+static struct soshell_dirlist *dircache_get(const char *path)
+{
+  struct soshell_dirlist *list, *old;
+  struct stat st;
+  unsigned long slot;
+  int fd;
+
+  if (stat(path, &st) != 0) {
+    return NULL;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    errno = ENOTDIR;
+    return NULL;
+  }
+
+  slot = dircache_slot(st.st_dev, st.st_ino);
+  for (list = dircache_table[slot]; list != NULL; list = list->hnext) {
+    if (list->dev == st.st_dev && list->ino == st.st_ino) {
+      break;
+    }
+  }
+  if (list != NULL) {
+    if (dircache_fresh(list, &st)) {
+      dircache_lru_unlink(list);
+      dircache_lru_push(list);
+      list->refs++;
+      return list;
+    }
+    dircache_remove(list);
+  }
+
+  fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return NULL;
+  }
+  // Stamps from the open directory, in case path was replaced meanwhile.
+  if (fstat(fd, &st) != 0 || (list = dircache_read(fd, &st)) == NULL) {
+    close(fd);
+    return NULL;
+  }
+  close(fd);
+
+  slot = dircache_slot(st.st_dev, st.st_ino);
+  for (old = dircache_table[slot]; old != NULL; old = old->hnext) {
+    if (old->dev == st.st_dev && old->ino == st.st_ino) {
+      dircache_remove(old);
+      break;
+    }
+  }
+  list->hnext = dircache_table[slot];
+  dircache_table[slot] = list;
+  dircache_lru_push(list);
+  dircache_bytes += list->bytes;
+  list->refs++;
+
+  while (dircache_bytes > DIRCACHE_MAX_BYTES && dircache_lru_tail != list) {
+    dircache_remove(dircache_lru_tail);
+  }
+  return list;
+}
+
+/**
+   @brief Get the listing of a directory, reading it only if it changed.
+   @param path The directory.
+   @return The listing, or NULL with errno set.  Release it with
+   soshell_dircache_put().
+ */
+struct soshell_dirlist *soshell_dircache_get(const char *path)
+{
+  struct soshell_dirlist *list;
+
+  pthread_mutex_lock(&dircache_lock);
+  list = dircache_get(path);
+  pthread_mutex_unlock(&dircache_lock);
+  return list;
+}
+
+/**
+   @brief Release a listing returned by soshell_dircache_get().
+   @param list The listing.
+ */
+void soshell_dircache_put(struct soshell_dirlist *list)
+{
+  pthread_mutex_lock(&dircache_lock);
+  dircache_put(list);
+  pthread_mutex_unlock(&dircache_lock);
+}
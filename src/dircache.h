@@ -0,0 +1,35 @@
+#ifndef SOSHELL_DIRCACHE_H
+#define SOSHELL_DIRCACHE_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+struct soshell_dirent {
+  const char *name;
+  unsigned char type;      /* DT_* value from getdents64 */
+};
+
+/*
+  A directory listing, in getdents64 order and including "." and "..".
+  Listings are shared; release them with soshell_dircache_put().
+ */
+struct soshell_dirlist {
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  struct timespec ctime;
+  time_t filled;           /* when the listing was read */
+  size_t n;
+  struct soshell_dirent *ents;
+  char *buf;               /* raw getdents64 records holding the names */
+  size_t bytes;
+  int refs;
+  struct soshell_dirlist *hnext;
+  struct soshell_dirlist *prev, *next;
+};
+
+struct soshell_dirlist *soshell_dircache_get(const char *path);
+void soshell_dircache_put(struct soshell_dirlist *list);
+
+#endif
@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "du.h"
+#include "io.h"
+#include "walk.h"
+
+/*
+  du [-s] [-h] [file...]
+
+  Sizes are disk usage (st_blocks), summed up the tree as directories
+  complete on the parallel walk.  A file with several links is counted
+  once: its (st_dev, st_ino) goes into a hash set split in stripes with
+  a lock each, so workers rarely wait on one another.  Directories are
+  printed as they complete, so siblings come in no fixed order.
+ */
+
+#define DU_STRIPES 64
+#define DU_STRIPE_INIT 64
+
+struct du_inode {
+  dev_t dev;
+  ino_t ino;               /* 0 marks a free slot */
+};
+
+struct du_stripe {
+  pthread_mutex_t lock;
+  struct du_inode *slots;  /* open addressing, cap a power of two */
+  size_t cap;
+  size_t n;
+} __attribute__((aligned(64)));
+
+struct du_ctx {
+  int summarize;
+  int human;
+  struct du_stripe stripes[DU_STRIPES];
+};
+
+struct du_dir {
+  atomic_ullong bytes;
+};
+
+static uint64_t du_hash(dev_t dev, ino_t ino)
+{
+  uint64_t h = ((uint64_t)dev * 0x9e3779b97f4a7c15ULL) ^ (uint64_t)ino;
+
+  h *= 0xff51afd7ed558ccdULL;
+  return h ^ (h >> 32);
+}
+
+/*
+  Record an inode.  Returns 1 if it had been seen before.
+ */
+static int du_seen(struct du_ctx *ctx, dev_t dev, ino_t ino)
+{
+  uint64_t h = du_hash(dev, ino);
+  struct du_stripe *s = &ctx->stripes[h % DU_STRIPES];
+  struct du_inode *old;
+  size_t i, j, oldcap;
+
+  pthread_mutex_lock(&s->lock);
+  if (2 * (s->n + 1) > s->cap) {
+    old = s->slots;
+    oldcap = s->cap;
+    s->cap = oldcap ? 2 * oldcap : DU_STRIPE_INIT;
+    s->slots = calloc(s->cap, sizeof(*s->slots));
+    if (!s->slots) {
+      fprintf(stderr, "soshell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < oldcap; i++) {
+      if (old[i].ino == 0) {
+        continue;
+      }
+      j = (du_hash(old[i].dev, old[i].ino) / DU_STRIPES) & (s->cap - 1);
+      while (s->slots[j].ino != 0) {
+        j = (j + 1) & (s->cap - 1);
+      }
+      s->slots[j] = old[i];
+    }
+    free(old);
+  }
+  for (i = (h / DU_STRIPES) & (s->cap - 1); s->slots[i].ino != 0; i = (i + 1) & (s->cap - 1)) {
+    if (s->slots[i].ino == ino && s->slots[i].dev == dev) {
+      pthread_mutex_unlock(&s->lock);
+      return 1;
+    }
+  }
+  s->slots[i].dev = dev;
+  s->slots[i].ino = ino;
+  s->n++;
+  pthread_mutex_unlock(&s->lock);
+  return 0;
+}
+
+/*
+  Format a size: 1K blocks, or with -h the largest unit that keeps the
+  number below 1024, with one decimal below 10.  Rounds up, as du does.
+ */
+static void du_format(char *buf, size_t n, uint64_t bytes, int human)
+{
+  static const char units[] = "KMGTPE";
+  uint64_t scale = 1024, tenths, whole;
+  int u;
+
+  if (!human) {
+    snprintf(buf, n, "%llu", (unsigned long long)((bytes + 1023) / 1024));
+    return;
+  }
+  if (bytes < 1024) {
+    snprintf(buf, n, "%llu", (unsigned long long)bytes);
+    return;
+  }
+  for (u = 0; ; u++, scale *= 1024) {
+    tenths = (bytes * 10 + scale - 1) / scale;
+    if (tenths < 100) {
+      snprintf(buf, n, "%llu.%llu%c", (unsigned long long)(tenths / 10),
+               (unsigned long long)(tenths % 10), units[u]);
+      return;
+    }
+    whole = (bytes + scale - 1) / scale;
+    if (whole < 1024 || units[u + 1] == '\0') {
+      snprintf(buf, n, "%llu%c", (unsigned long long)whole, units[u]);
+      return;
+    }
+  }
+}
+
+static void du_print(struct soshell_walk *walk, struct du_ctx *ctx,
+                     uint64_t bytes, const char *path)
+{
+  char size[32];
+
+  du_format(size, sizeof(size), bytes, ctx->human);
+  soshell_walk_lock(walk);
+  soshell_out_printf("%s\t%s\n", size, path);
+  soshell_walk_unlock(walk);
+}
+
+static int du_visit(struct soshell_walk *walk, const struct soshell_walk_ent *ent, void **data)
+{
+  struct du_ctx *ctx = soshell_walk_ctx(walk);
+  struct du_dir *parent = ent->parent, *dir;
+  uint64_t bytes = (uint64_t)ent->st->st_blocks * 512;
+
+  if (!S_ISDIR(ent->st->st_mode) && ent->st->st_nlink > 1 &&
+      du_seen(ctx, ent->st->st_dev, ent->st->st_ino)) {
+    return 0;
+  }
+  if (S_ISDIR(ent->st->st_mode)) {
+    dir = malloc(sizeof(*dir));
+    if (!dir) {
+      fprintf(stderr, "soshell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+    atomic_init(&dir->bytes, bytes);
+    *data = dir;
+    return 1;
+  }
+  if (parent) {
+    atomic_fetch_add(&parent->bytes, bytes);
+  } else {
+    // A file named on the command line.
+    du_print(walk, ctx, bytes, ent->path);
+  }
+  return 0;
+}
+
+static void du_leave(struct soshell_walk *walk, const struct soshell_walk_ent *ent, void *data)
+{
+  struct du_ctx *ctx = soshell_walk_ctx(walk);
+  struct du_dir *dir = data, *parent = ent->parent;
+  uint64_t bytes = atomic_load(&dir->bytes);
+
+  if (!ctx->summarize || ent->depth == 0) {
+    du_print(walk, ctx, bytes, ent->path);
+  }
+  if (parent) {
+    atomic_fetch_add(&parent->bytes, bytes);
+  }
+  free(dir);
+}
+
+/**
+   @brief Builtin command: estimate disk usage.
+   @param args List of args.  Options -s (totals only) and -h (human
+   readable sizes), then files; none means ".".
+   @return Always returns 1, to continue executing.
+ */
+int soshell_du(char **args)
+{
+  struct soshell_walk_ops ops;
+  struct du_ctx *ctx;
+  const char *opt;
+  char *dot[] = { ".", NULL };
+  int i;
+
+  ctx = aligned_alloc(64, sizeof(*ctx));
+  if (!ctx) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  memset(ctx, 0, sizeof(*ctx));
+  for (i = 0; i < DU_STRIPES; i++) {
+    pthread_mutex_init(&ctx->stripes[i].lock, NULL);
+  }
+  for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+    for (opt = args[i] + 1; *opt; opt++) {
+      if (*opt == 's') {
+        ctx->summarize = 1;
+      } else if (*opt == 'h') {
+        ctx->human = 1;
+      } else {
+        fprintf(stderr, "soshell: du: unknown option -%c\n", *opt);
+        free(ctx);
+        return 1;
+      }
+    }
+  }
+  memset(&ops, 0, sizeof(ops));
+  ops.cmd = "du";
+  ops.want_stat = 1;
+  ops.visit = du_visit;
+  ops.leave = du_leave;
+  ops.ctx = ctx;
+  soshell_walk(args[i] ? args + i : dot, &ops);
+
+  for (i = 0; i < DU_STRIPES; i++) {
+    pthread_mutex_destroy(&ctx->stripes[i].lock);
+    free(ctx->stripes[i].slots);
+  }
+  free(ctx);
+  return 1;
+}
@@ -0,0 +1,6 @@
+#ifndef SOSHELL_DU_H
+#define SOSHELL_DU_H
+
+int soshell_du(char **args);
+
+#endif
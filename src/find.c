@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "find.h"
+#include "io.h"
+#include "walk.h"
+
+/*
+  find [path...] [-maxdepth n] [expression]
+
+  The expression is a list of primaries joined by an implicit -a and
+  by -o, each optionally negated with '!':  -name, -iname, -type,
+  -size, -mtime, -prune, -print and -print0.  Without -print or
+  -print0 anywhere, entries for which it is true are printed.
+
+  The tree is read on the shared parallel walker, so entries come out
+  as soon as they are found and in no fixed order between siblings.
+  Entries are only stat'ed when -size or -mtime needs it.
+ */
+
+enum find_kind {
+  FIND_OR,
+  FIND_NAME,
+  FIND_INAME,
+  FIND_TYPE,
+  FIND_SIZE,
+  FIND_MTIME,
+  FIND_PRUNE,
+  FIND_PRINT,
+  FIND_PRINT0
+};
+
+struct find_pred {
+  enum find_kind kind;
+  int negate;
+  int cmp;                 /* -1, 0 or 1 for -N, N and +N */
+  const char *pattern;
+  unsigned char type;      /* DT_* for -type */
+  long long n;
+  long long unit;          /* bytes per unit for -size */
+};
+
+struct find_ctx {
+  struct find_pred *preds;
+  int npreds;
+  int maxdepth;            /* -1 if none */
+  int implicit_print;
+  time_t now;
+};
+
+static int find_compare(long long value, int cmp, long long n)
+{
+  if (cmp < 0) {
+    return value < n;
+  }
+  if (cmp > 0) {
+    return value > n;
+  }
+  return value == n;
+}
+
+static void find_print(struct soshell_walk *walk, const char *path, char end)
+{
+  soshell_walk_lock(walk);
+  soshell_out_puts(path);
+  soshell_out_write(&end, 1);
+  soshell_walk_unlock(walk);
+}
+
+static int find_pred(struct soshell_walk *walk, const struct find_ctx *ctx,
+                     const struct find_pred *p, const struct soshell_walk_ent *ent, int *prune)
+{
+  switch (p->kind) {
+  case FIND_NAME:
+    return fnmatch(p->pattern, ent->name, 0) == 0;
+  case FIND_INAME:
+    return fnmatch(p->pattern, ent->name, FNM_CASEFOLD) == 0;
+  case FIND_TYPE:
+    return ent->type == p->type;
+  case FIND_SIZE:
+    return find_compare((ent->st->st_size + p->unit - 1) / p->unit, p->cmp, p->n);
+  case FIND_MTIME:
+    return find_compare((ctx->now - ent->st->st_mtime) / 86400, p->cmp, p->n);
+  case FIND_PRUNE:
+    *prune = 1;
+    return 1;
+  case FIND_PRINT:
+    find_print(walk, ent->path, '\n');
+    return 1;
+  case FIND_PRINT0:
+    find_print(walk, ent->path, '\0');
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static int find_visit(struct soshell_walk *walk, const struct soshell_walk_ent *ent, void **data)
+{
+  const struct find_ctx *ctx = soshell_walk_ctx(walk);
+  const struct find_pred *p;
+  int i, result = 1, prune = 0;
+
+  for (i = 0; i < ctx->npreds; i++) {
+    p = &ctx->preds[i];
+    if (p->kind == FIND_OR) {
+      if (result) {
+        break;
+      }
+      result = 1;
+      continue;
+    }
+    // Once one primary of an -a chain is false, skip to the next -o.
+    if (result) {
+      result = find_pred(walk, ctx, p, ent, &prune) != p->negate;
+    }
+  }
+  if (result && ctx->implicit_print) {
+    find_print(walk, ent->path, '\n');
+  }
+  return !prune && (ctx->maxdepth < 0 || ent->depth < ctx->maxdepth);
+}
+
+/*
+  Parse [+-]N with an optional unit suffix for -size.
+ */
+static int find_parse_number(const char *s, struct find_pred *p, int size)
+{
+  char *end;
+
+  p->cmp = (*s == '+') ? 1 : (*s == '-') ? -1 : 0;
+  if (*s == '+' || *s == '-') {
+    s++;
+  }
+  p->n = strtoll(s, &end, 10);
+  if (end == s) {
+    return -1;
+  }
+  p->unit = 512;
+  if (size && *end != '\0') {
+    switch (*end++) {
+    case 'c': p->unit = 1; break;
+    case 'k': p->unit = 1024; break;
+    case 'M': p->unit = 1024 * 1024; break;
+    case 'G': p->unit = 1024 * 1024 * 1024; break;
+    default: return -1;
+    }
+  }
+  return *end == '\0' ? 0 : -1;
+}
+
+static int find_parse_type(const char *s, struct find_pred *p)
+{
+  static const char letters[] = "fdlpscb";
+  static const unsigned char types[] = {
+    DT_REG, DT_DIR, DT_LNK, DT_FIFO, DT_SOCK, DT_CHR, DT_BLK
+  };
+  const char *c;
+
+  if (s[0] == '\0' || s[1] != '\0' || (c = strchr(letters, s[0])) == NULL) {
+    return -1;
+  }
+  p->type = types[c - letters];
+  return 0;
+}
+
+/**
+   @brief Builtin command: search directory trees.
+   @param args List of args.  Paths (none means "."), then the
+   expression.
+   @return Always returns 1, to continue executing.
+ */
+int soshell_find(char **args)
+{
+  struct soshell_walk_ops ops;
+  struct find_ctx ctx;
+  struct find_pred *p;
+  char **roots, *dot[] = { ".", NULL };
+  const char *arg, *val;
+  int i, argc, nroots, negate = 0, actions = 0, want_stat = 0, err = 0;
+
+  for (nroots = 0; args[1 + nroots] != NULL; nroots++) {
+    arg = args[1 + nroots];
+    if ((arg[0] == '-' && arg[1] != '\0') || strcmp(arg, "!") == 0) {
+      break;
+    }
+  }
+  for (argc = 0; args[argc] != NULL; argc++) {}
+
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.maxdepth = -1;
+  ctx.now = time(NULL);
+  ctx.preds = calloc(argc, sizeof(*ctx.preds));
+  roots = calloc(nroots + 1, sizeof(*roots));
+  if (!ctx.preds || !roots) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(roots, args + 1, nroots * sizeof(*roots));
+
+  for (i = 1 + nroots; args[i] != NULL && !err; i++) {
+    arg = args[i];
+    if (strcmp(arg, "!") == 0 || strcmp(arg, "-not") == 0) {
+      negate = !negate;
+      continue;
+    }
+    if (strcmp(arg, "-a") == 0 || strcmp(arg, "-and") == 0) {
+      continue;
+    }
+    p = &ctx.preds[ctx.npreds];
+    p->negate = negate;
+    negate = 0;
+    if (strcmp(arg, "-o") == 0 || strcmp(arg, "-or") == 0) {
+      p->kind = FIND_OR;
+      ctx.npreds++;
+      continue;
+    }
+    if (strcmp(arg, "-prune") == 0) {
+      p->kind = FIND_PRUNE;
+      ctx.npreds++;
+      continue;
+    }
+    if (strcmp(arg, "-print") == 0 || strcmp(arg, "-print0") == 0) {
+      p->kind = (arg[6] == '0') ? FIND_PRINT0 : FIND_PRINT;
+      actions++;
+      ctx.npreds++;
+      continue;
+    }
+    val = args[i + 1];
+    if (val == NULL) {
+      fprintf(stderr, "soshell: find: %s needs an argument\n", arg);
+      err = 1;
+      break;
+    }
+    i++;
+    if (strcmp(arg, "-maxdepth") == 0) {
+      ctx.maxdepth = atoi(val);
+      continue;
+    } else if (strcmp(arg, "-name") == 0 || strcmp(arg, "-iname") == 0) {
+      p->kind = (arg[1] == 'i') ? FIND_INAME : FIND_NAME;
+      p->pattern = val;
+    } else if (strcmp(arg, "-type") == 0) {
+      p->kind = FIND_TYPE;
+      err = find_parse_type(val, p);
+    } else if (strcmp(arg, "-size") == 0) {
+      p->kind = FIND_SIZE;
+      err = find_parse_number(val, p, 1);
+      want_stat = 1;
+    } else if (strcmp(arg, "-mtime") == 0) {
+      p->kind = FIND_MTIME;
+      err = find_parse_number(val, p, 0);
+      want_stat = 1;
+    } else {
+      fprintf(stderr, "soshell: find: unknown primary %s\n", arg);
+      err = 1;
+      break;
+    }
+    if (err) {
+      fprintf(stderr, "soshell: find: bad argument to %s: %s\n", arg, val);
+      break;
+    }
+    ctx.npreds++;
+  }
+  if (err) {
+    free(ctx.preds);
+    free(roots);
+    return 1;
+  }
+  ctx.implicit_print = (actions == 0);
+
+  memset(&ops, 0, sizeof(ops));
+  ops.cmd = "find";
+  ops.want_stat = want_stat;
+  ops.visit = find_visit;
+  ops.ctx = &ctx;
+  soshell_walk(nroots ? roots : dot, &ops);
+  free(ctx.preds);
+  free(roots);
+  return 1;
+}
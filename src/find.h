@@ -0,0 +1,6 @@
+#ifndef SOSHELL_FIND_H
+#define SOSHELL_FIND_H
+
+int soshell_find(char **args);
+
+#endif
@@ -0,0 +1,571 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "glob.h"
+#include "arena.h"
+#include "dircache.h"
+#include "var.h"
+
+/*
+  Pathname expansion: *, ?, [...] and recursive **.
+
+  A pattern is split on '/' into segments, and each segment that is not
+  a plain name is compiled into a small op list matched without
+  backtracking beyond the last star.  The tree is walked one directory
+  at a time, carrying the set of segments that are still live at that
+  directory, so every directory is listed exactly once no matter how
+  many segments or ** components can reach it.  Listings come from the
+  shared directory cache, so expanding the same pattern again costs a
+  stat() per directory.
+ */
+
+#define GLOB_MAX_SEGS 64
+
+enum glob_op_kind {
+  GLOB_OP_LIT,
+  GLOB_OP_ANY,
+  GLOB_OP_STAR,
+  GLOB_OP_CLASS
+};
+
+struct glob_op {
+  enum glob_op_kind kind;
+  unsigned char ch;
+  unsigned char set[32];
+};
+
+enum glob_seg_kind {
+  GLOB_SEG_LITERAL,
+  GLOB_SEG_PATTERN,
+  GLOB_SEG_GLOBSTAR
+};
+
+struct glob_seg {
+  enum glob_seg_kind kind;
+  char *lit;               /* unescaped name, for literal segments */
+  struct glob_op *ops;
+  int nops;
+  size_t minlen;           /* number of non-star ops */
+  int dot_ok;              /* segment may match names starting with '.' */
+};
+
+struct glob_ctx {
+  struct glob_seg segs[GLOB_MAX_SEGS];
+  int nsegs;
+  int want_dir;            /* pattern ended in '/' */
+  char **results;
+  size_t nresults;
+  size_t cap;
+};
+
+/**
+   @brief Check whether a word contains unescaped glob characters.
+   @param word The word.
+   @return 1 if it does, 0 otherwise.
+ */
+int soshell_glob_has_magic(const char *word)
+{
+  for (; *word; word++) {
+    if (*word == '\\' && word[1] != '\0') {
+      word++;
+    } else if (*word == '*' || *word == '?' || *word == '[') {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void glob_set_bit(unsigned char *set, unsigned char c)
+{
+  set[c >> 3] |= 1 << (c & 7);
+}
+
+/*
+  Parse a bracket expression starting just after '['.  Returns a pointer
+  past the closing ']', or NULL if it is unterminated (the '[' is then
+  an ordinary character).
+ */
+static const char *glob_parse_class(const char *p, const char *end, struct glob_op *op)
+{
+  static const struct { const char *name; int (*fn)(int); } classes[] = {
+    { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+    { "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+    { "lower", islower }, { "print", isprint }, { "punct", ispunct },
+    { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+  };
+  int negate = 0, first = 1, c, i, k;
+  unsigned char lo, hi;
+
+  memset(op->set, 0, sizeof(op->set));
+  if (p < end && (*p == '!' || *p == '^')) {
+    negate = 1;
+    p++;
+  }
+  while (p < end && (*p != ']' || first)) {
+    first = 0;
+    if (*p == '[' && p + 1 < end && p[1] == ':') {
+      for (k = 0; k < (int)(sizeof(classes) / sizeof(classes[0])); k++) {
+        size_t n = strlen(classes[k].name);
+        if (p + 2 + n + 1 < end && strncmp(p + 2, classes[k].name, n) == 0 &&
+            p[2 + n] == ':' && p[3 + n] == ']') {
+          for (c = 1; c < 256; c++) {
+            if (classes[k].fn(c)) {
+              glob_set_bit(op->set, c);
+            }
+          }
+          p += 4 + n;
+          break;
+        }
+      }
+      if (k < (int)(sizeof(classes) / sizeof(classes[0]))) {
+        continue;
+      }
+    }
+    if (*p == '\\' && p + 1 < end) {
+      p++;
+    }
+    lo = hi = (unsigned char)*p++;
+    if (p + 1 < end && *p == '-' && p[1] != ']') {
+      p++;
+      if (*p == '\\' && p + 1 < end) {
+        p++;
+      }
+      hi = (unsigned char)*p++;
+    }
+    for (c = lo; c <= hi; c++) {
+      glob_set_bit(op->set, c);
+    }
+  }
+  if (p >= end) {
+    return NULL;
+  }
+  if (negate) {
+    for (i = 0; i < 32; i++) {
+      op->set[i] = ~op->set[i];
+    }
+  }
+  // A slash never appears in a name; keep it out so the set is exact.
+  op->set['/' >> 3] &= ~(1 << ('/' & 7));
+  op->kind = GLOB_OP_CLASS;
+  return p + 1;
+}
+
+/*
+  Compile one path segment [p, end).
+ */
+static void glob_compile_seg(struct glob_seg *seg, const char *p, const char *end)
+{
+  struct glob_op *ops = soshell_arena_alloc((end - p) * sizeof(*ops));
+  const char *next;
+  char *lit = soshell_arena_alloc(end - p + 1);
+  int n = 0, magic = 0;
+  size_t litlen = 0;
+
+  memset(seg, 0, sizeof(*seg));
+  if (end - p == 2 && p[0] == '*' && p[1] == '*') {
+    seg->kind = GLOB_SEG_GLOBSTAR;
+    return;
+  }
+
+  while (p < end) {
+    if (*p == '*') {
+      magic = 1;
+      p++;
+      // Consecutive stars are one star.
+      if (n > 0 && ops[n - 1].kind == GLOB_OP_STAR) {
+        continue;
+      }
+      ops[n++].kind = GLOB_OP_STAR;
+      continue;
+    }
+    if (*p == '?') {
+      magic = 1;
+      ops[n++].kind = GLOB_OP_ANY;
+      seg->minlen++;
+      p++;
+      continue;
+    }
+    if (*p == '[' && (next = glob_parse_class(p + 1, end, &ops[n])) != NULL) {
+      magic = 1;
+      n++;
+      seg->minlen++;
+      p = next;
+      continue;
+    }
+    if (*p == '\\' && p + 1 < end) {
+      p++;
+    }
+    ops[n].kind = GLOB_OP_LIT;
+    ops[n++].ch = (unsigned char)*p;
+    lit[litlen++] = *p++;
+    seg->minlen++;
+  }
+  lit[litlen] = '\0';
+
+  seg->kind = magic ? GLOB_SEG_PATTERN : GLOB_SEG_LITERAL;
+  seg->lit = lit;
+  seg->ops = ops;
+  seg->nops = n;
+  seg->dot_ok = (n > 0 && ops[0].kind == GLOB_OP_LIT && ops[0].ch == '.');
+}
+
+static int glob_op_matches(const struct glob_op *op, unsigned char c)
+{
+  switch (op->kind) {
+  case GLOB_OP_LIT:
+    return op->ch == c;
+  case GLOB_OP_CLASS:
+    return (op->set[c >> 3] >> (c & 7)) & 1;
+  default:
+    return 1;
+  }
+}
+
+/*
+  Match a name against a compiled segment.  On a mismatch only the most
+  recent star is retried, which is sufficient because every other op
+  consumes exactly one character.
+ */
+static int glob_match(const struct glob_seg *seg, const char *s, size_t len)
+{
+  const struct glob_op *ops = seg->ops;
+  int n = seg->nops, i = 0, star = -1;
+  size_t j = 0, star_j = 0;
+
+  if (len < seg->minlen || (s[0] == '.' && !seg->dot_ok)) {
+    return 0;
+  }
+  if (n > 0 && ops[n - 1].kind == GLOB_OP_LIT && (unsigned char)s[len - 1] != ops[n - 1].ch) {
+    return 0;
+  }
+
+  while (j < len) {
+    if (i < n && ops[i].kind == GLOB_OP_STAR) {
+      star = ++i;
+      star_j = j;
+    } else if (i < n && glob_op_matches(&ops[i], (unsigned char)s[j])) {
+      i++;
+      j++;
+    } else if (star >= 0) {
+      i = star;
+      j = ++star_j;
+    } else {
+      return 0;
+    }
+  }
+  while (i < n && ops[i].kind == GLOB_OP_STAR) {
+    i++;
+  }
+  return i == n;
+}
+
+static void glob_add_result(struct glob_ctx *ctx, const char *prefix, size_t plen,
+                            const char *name, int slash)
+{
+  size_t nlen = strlen(name);
+  char *path = soshell_arena_alloc(plen + nlen + 2);
+
+  memcpy(path, prefix, plen);
+  memcpy(path + plen, name, nlen);
+  if (slash) {
+    path[plen + nlen++] = '/';
+  }
+  path[plen + nlen] = '\0';
+
+  if (ctx->nresults == ctx->cap) {
+    ctx->cap = ctx->cap ? ctx->cap * 2 : 64;
+    ctx->results = realloc(ctx->results, ctx->cap * sizeof(char *));
+    if (!ctx->results) {
+      fprintf(stderr, "soshell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  ctx->results[ctx->nresults++] = path;
+}
+
+/*
+  Add the segments reachable from the given ones without consuming a
+  directory: a ** may match zero directories.
+ */
+static uint64_t glob_closure(struct glob_ctx *ctx, uint64_t states)
+{
+  int s;
+
+  for (s = 0; s < ctx->nsegs - 1; s++) {
+    if ((states >> s & 1) && ctx->segs[s].kind == GLOB_SEG_GLOBSTAR) {
+      states |= (uint64_t)1 << (s + 1);
+    }
+  }
+  return states;
+}
+
+static void glob_dir(struct glob_ctx *ctx, char *prefix, size_t plen, uint64_t states);
+
+/*
+  Descend into prefix/name/ with the given live segments.
+ */
+static void glob_descend(struct glob_ctx *ctx, char *prefix, size_t plen,
+                         const char *name, uint64_t states)
+{
+  size_t nlen = strlen(name);
+
+  if (plen + nlen + 2 > PATH_MAX) {
+    return;
+  }
+  memcpy(prefix + plen, name, nlen);
+  prefix[plen + nlen] = '/';
+  prefix[plen + nlen + 1] = '\0';
+  glob_dir(ctx, prefix, plen + nlen + 1, glob_closure(ctx, states));
+  prefix[plen] = '\0';
+}
+
+/*
+  Handle a directory where every live segment is a plain name: nothing
+  needs to be listed, only looked up.
+ */
+static void glob_dir_literal(struct glob_ctx *ctx, char *prefix, size_t plen, uint64_t states)
+{
+  struct stat st;
+  int s, last;
+  char *name;
+
+  for (s = 0; s < ctx->nsegs; s++) {
+    if (!(states >> s & 1)) {
+      continue;
+    }
+    name = ctx->segs[s].lit;
+    last = (s == ctx->nsegs - 1);
+    if (plen + strlen(name) + 2 > PATH_MAX) {
+      continue;
+    }
+    strcpy(prefix + plen, name);
+    if (last && !ctx->want_dir && lstat(prefix, &st) == 0) {
+      prefix[plen] = '\0';
+      glob_add_result(ctx, prefix, plen, name, 0);
+    } else if (stat(prefix, &st) == 0 && S_ISDIR(st.st_mode)) {
+      prefix[plen] = '\0';
+      if (last) {
+        glob_add_result(ctx, prefix, plen, name, 1);
+      } else {
+        glob_descend(ctx, prefix, plen, name, (uint64_t)1 << (s + 1));
+      }
+    }
+    prefix[plen] = '\0';
+  }
+}
+
+/*
+  stat() prefix/name, using the prefix buffer to build the path.
+ */
+static int glob_stat_dir(char *prefix, size_t plen, const char *name, int follow)
+{
+  struct stat st;
+  size_t nlen = strlen(name);
+  int ret;
+
+  if (plen + nlen + 1 > PATH_MAX) {
+    return 0;
+  }
+  memcpy(prefix + plen, name, nlen + 1);
+  ret = (follow ? stat(prefix, &st) : lstat(prefix, &st)) == 0 && S_ISDIR(st.st_mode);
+  prefix[plen] = '\0';
+  return ret;
+}
+
+static void glob_dir(struct glob_ctx *ctx, char *prefix, size_t plen, uint64_t states)
+{
+  struct soshell_dirlist *list;
+  struct soshell_dirent *ent;
+  uint64_t *next, literal = 0;
+  const char *name;
+  size_t e, len;
+  int s, last, isdir, realdir;
+  const struct glob_seg *seg;
+
+  for (s = 0; s < ctx->nsegs; s++) {
+    if ((states >> s & 1) && ctx->segs[s].kind == GLOB_SEG_LITERAL) {
+      literal |= (uint64_t)1 << s;
+    }
+  }
+  if (literal == states) {
+    glob_dir_literal(ctx, prefix, plen, states);
+    return;
+  }
+
+  list = soshell_dircache_get(plen ? prefix : ".");
+  if (list == NULL) {
+    return;
+  }
+  next = calloc(list->n ? list->n : 1, sizeof(*next));
+  if (!next) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (e = 0; e < list->n; e++) {
+    ent = &list->ents[e];
+    name = ent->name;
+    len = strlen(name);
+
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+      continue;
+    }
+    // -1 means "not looked up yet"; only stat when a segment needs it.
+    isdir = (ent->type == DT_DIR) ? 1 : (ent->type == DT_UNKNOWN ||
+                                         ent->type == DT_LNK) ? -1 : 0;
+    realdir = (ent->type == DT_DIR) ? 1 : (ent->type == DT_UNKNOWN) ? -1 : 0;
+
+    for (s = 0; s < ctx->nsegs; s++) {
+      if (!(states >> s & 1)) {
+        continue;
+      }
+      seg = &ctx->segs[s];
+      last = (s == ctx->nsegs - 1);
+
+      if (seg->kind == GLOB_SEG_GLOBSTAR) {
+        if (name[0] == '.') {
+          continue;
+        }
+        // ** does not follow symlinks, so it cannot loop.
+        if (realdir < 0) {
+          realdir = glob_stat_dir(prefix, plen, name, 0);
+        }
+        if (last && (!ctx->want_dir || realdir)) {
+          glob_add_result(ctx, prefix, plen, name, ctx->want_dir);
+        }
+        if (realdir) {
+          next[e] |= (uint64_t)1 << s;
+        }
+        continue;
+      }
+
+      if (seg->kind == GLOB_SEG_LITERAL ? strcmp(seg->lit, name) != 0
+                                        : !glob_match(seg, name, len)) {
+        continue;
+      }
+      if (isdir < 0 && (ctx->want_dir || !last)) {
+        isdir = glob_stat_dir(prefix, plen, name, 1);
+      }
+      if (last) {
+        if (!ctx->want_dir || isdir) {
+          glob_add_result(ctx, prefix, plen, name, ctx->want_dir);
+        }
+      } else if (isdir) {
+        next[e] |= (uint64_t)1 << (s + 1);
+      }
+    }
+  }
+
+  for (e = 0; e < list->n; e++) {
+    if (next[e]) {
+      glob_descend(ctx, prefix, plen, list->ents[e].name, next[e]);
+    }
+  }
+
+  free(next);
+  soshell_dircache_put(list);
+}
+
+static int glob_cmp(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+  Expand one pattern, appending sorted matches to ctx->results.  Returns
+  the number of matches.
+ */
+static size_t glob_pattern(struct glob_ctx *ctx, const char *pattern)
+{
+  char prefix[PATH_MAX];
+  const char *p = pattern, *end = pattern + strlen(pattern), *slash;
+  size_t first = ctx->nresults, plen = 0, i, out;
+
+  ctx->nsegs = 0;
+  ctx->want_dir = 0;
+  while (end > p && end[-1] == '/') {
+    end--;
+    ctx->want_dir = 1;
+  }
+  if (*p == '/') {
+    prefix[plen++] = '/';
+    while (*p == '/') {
+      p++;
+    }
+  }
+  prefix[plen] = '\0';
+
+  while (p < end) {
+    slash = memchr(p, '/', end - p);
+    if (slash == NULL) {
+      slash = end;
+    }
+    if (slash > p) {
+      if (ctx->nsegs == GLOB_MAX_SEGS) {
+        return 0;
+      }
+      glob_compile_seg(&ctx->segs[ctx->nsegs++], p, slash);
+    }
+    p = slash + 1;
+  }
+  if (ctx->nsegs == 0) {
+    return 0;
+  }
+
+  glob_dir(ctx, prefix, plen, glob_closure(ctx, 1));
+
+  qsort(ctx->results + first, ctx->nresults - first, sizeof(char *), glob_cmp);
+  // ** can reach the same path more than once.
+  for (i = first, out = first; i < ctx->nresults; i++) {
+    if (out == first || strcmp(ctx->results[out - 1], ctx->results[i]) != 0) {
+      ctx->results[out++] = ctx->results[i];
+    }
+  }
+  ctx->nresults = out;
+  return out - first;
+}
+
+/**
+   @brief Perform pathname expansion on a list of arguments.
+   @param args Null-terminated list of arguments.
+   @return args itself if nothing was expanded, otherwise a new list
+   allocated in the command arena.  Patterns that match nothing are
+   kept as they are.
+ */
+char **soshell_glob_expand(char **args)
+{
+  struct glob_ctx ctx;
+  char **out;
+  size_t i, assigning = 1;
+
+  for (i = 0; args[i] != NULL; i++) {
+    if (soshell_glob_has_magic(args[i])) {
+      break;
+    }
+  }
+  if (args[i] == NULL) {
+    return args;
+  }
+
+  memset(&ctx, 0, sizeof(ctx));
+  for (i = 0; args[i] != NULL; i++) {
+    // Leading NAME=value words are assignments, not pathnames.
+    assigning = assigning && soshell_var_is_assignment(args[i]);
+    if (assigning || !soshell_glob_has_magic(args[i]) || glob_pattern(&ctx, args[i]) == 0) {
+      glob_add_result(&ctx, "", 0, args[i], 0);
+    }
+  }
+
+  out = soshell_arena_alloc((ctx.nresults + 1) * sizeof(char *));
+  memcpy(out, ctx.results, ctx.nresults * sizeof(char *));
+  out[ctx.nresults] = NULL;
+  free(ctx.results);
+  return out;
+}
@@ -0,0 +1,7 @@
+#ifndef SOSHELL_GLOB_H
+#define SOSHELL_GLOB_H
+
+int soshell_glob_has_magic(const char *word);
+char **soshell_glob_expand(char **args);
+
+#endif
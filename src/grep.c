@@ -0,0 +1,651 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "grep.h"
+#include "io.h"
+#include "job.h"
+#include "shell.h"
+
+/*
+  grep [-F] [-v] [-c] [-n] [-l] [-q] pattern [file...]
+
+  Patterns are fixed strings (-F) or basic regular expressions made of
+  literals, '.', '[...]', '*', '^' and '$'.  The longest run of
+  literals every match must contain is found at compile time, and the
+  input buffer is scanned for it with a SIMD substring search; only the
+  lines where it occurs are handed to the matcher.  For -F the search
+  is the whole match.
+
+  The status is 0 when a line was selected, 1 when none was, and 2 on
+  errors, unless -q found a line.
+ */
+
+#define GREP_BUFSIZE (256 * 1024)
+
+enum grep_op_kind {
+  GREP_OP_END,
+  GREP_OP_LIT,
+  GREP_OP_ANY,
+  GREP_OP_CLASS
+};
+
+struct grep_op {
+  enum grep_op_kind kind;
+  int star;                /* zero or more of this op */
+  unsigned char ch;
+  unsigned char set[32];
+};
+
+struct grep_re {
+  struct grep_op *ops;
+  int bol;                 /* anchored at the start of the line */
+  int eol;                 /* anchored at the end of the line */
+  int fixed;               /* the literal is the whole pattern */
+  unsigned char *lit;      /* required literal, may be empty */
+  size_t litlen;
+};
+
+struct grep_opts {
+  int invert;
+  int count;
+  int number;
+  int list;
+  int quiet;
+  int first;               /* only the first match counts: -l, -q */
+  int prefix;              /* print file names before lines */
+};
+
+typedef const unsigned char *(*grep_find_fn)(const unsigned char *h, size_t n,
+                                             const unsigned char *lit, size_t k);
+
+static const unsigned char *grep_find_scalar(const unsigned char *h, size_t n,
+                                             const unsigned char *lit, size_t k)
+{
+  if (k == 1) {
+    return memchr(h, lit[0], n);
+  }
+  return memmem(h, n, lit, k);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+  Compare the first and the last byte of the literal against 16 or 32
+  positions at once; only positions where both agree are checked with
+  memcmp.  Matching two bytes far apart rejects almost every candidate
+  that a single-byte memchr would stop at.
+ */
+__attribute__((target("sse2")))
+static const unsigned char *grep_find_sse2(const unsigned char *h, size_t n,
+                                           const unsigned char *lit, size_t k)
+{
+  const __m128i first = _mm_set1_epi8(lit[0]), last = _mm_set1_epi8(lit[k - 1]);
+  unsigned mask, bit;
+  size_t i;
+
+  if (k < 2) {
+    return grep_find_scalar(h, n, lit, k);
+  }
+  for (i = 0; i + k - 1 + 16 <= n; i += 16) {
+    mask = _mm_movemask_epi8(_mm_and_si128(
+             _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(h + i)), first),
+             _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(h + i + k - 1)), last)));
+    while (mask) {
+      bit = __builtin_ctz(mask);
+      if (memcmp(h + i + bit + 1, lit + 1, k - 2) == 0) {
+        return h + i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+  return (i < n) ? grep_find_scalar(h + i, n - i, lit, k) : NULL;
+}
+
+__attribute__((target("avx2")))
+static const unsigned char *grep_find_avx2(const unsigned char *h, size_t n,
+                                           const unsigned char *lit, size_t k)
+{
+  const __m256i first = _mm256_set1_epi8(lit[0]), last = _mm256_set1_epi8(lit[k - 1]);
+  unsigned mask, bit;
+  size_t i;
+
+  if (k < 2) {
+    return grep_find_scalar(h, n, lit, k);
+  }
+  for (i = 0; i + k - 1 + 32 <= n; i += 32) {
+    mask = _mm256_movemask_epi8(_mm256_and_si256(
+             _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(h + i)), first),
+             _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(h + i + k - 1)), last)));
+    while (mask) {
+      bit = __builtin_ctz(mask);
+      if (memcmp(h + i + bit + 1, lit + 1, k - 2) == 0) {
+        return h + i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+  return (i < n) ? grep_find_scalar(h + i, n - i, lit, k) : NULL;
+}
+#endif
+
+static grep_find_fn grep_find(void)
+{
+  static grep_find_fn find;
+
+  if (find == NULL) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      find = grep_find_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+      find = grep_find_sse2;
+    } else {
+      find = grep_find_scalar;
+    }
+#else
+    find = grep_find_scalar;
+#endif
+  }
+  return find;
+}
+
+static void grep_set_bit(unsigned char *set, unsigned char c)
+{
+  set[c >> 3] |= 1 << (c & 7);
+}
+
+/*
+  Parse a bracket expression starting just after '['.  Returns a pointer
+  past the closing ']', or NULL if it is unterminated.
+ */
+static const char *grep_parse_class(const char *p, struct grep_op *op)
+{
+  static const struct { const char *name; int (*fn)(int); } classes[] = {
+    { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+    { "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+    { "lower", islower }, { "print", isprint }, { "punct", ispunct },
+    { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+  };
+  int negate = 0, first = 1, c, i, k;
+  unsigned char lo, hi;
+
+  memset(op->set, 0, sizeof(op->set));
+  if (*p == '^') {
+    negate = 1;
+    p++;
+  }
+  while (*p != '\0' && (*p != ']' || first)) {
+    first = 0;
+    if (*p == '[' && p[1] == ':') {
+      for (k = 0; k < (int)(sizeof(classes) / sizeof(classes[0])); k++) {
+        size_t n = strlen(classes[k].name);
+        if (strncmp(p + 2, classes[k].name, n) == 0 && p[2 + n] == ':' && p[3 + n] == ']') {
+          for (c = 1; c < 256; c++) {
+            if (classes[k].fn(c)) {
+              grep_set_bit(op->set, c);
+            }
+          }
+          p += 4 + n;
+          break;
+        }
+      }
+      if (k < (int)(sizeof(classes) / sizeof(classes[0]))) {
+        continue;
+      }
+    }
+    lo = hi = (unsigned char)*p++;
+    if (*p == '-' && p[1] != ']' && p[1] != '\0') {
+      hi = (unsigned char)p[1];
+      p += 2;
+    }
+    for (c = lo; c <= hi; c++) {
+      grep_set_bit(op->set, c);
+    }
+  }
+  if (*p == '\0') {
+    return NULL;
+  }
+  if (negate) {
+    for (i = 0; i < 32; i++) {
+      op->set[i] = ~op->set[i];
+    }
+  }
+  op->set['\n' >> 3] &= ~(1 << ('\n' & 7));
+  op->kind = GREP_OP_CLASS;
+  return p + 1;
+}
+
+/*
+  Pick the longest run of consecutive plain literals; every match of
+  the pattern contains it.
+ */
+static void grep_required_literal(struct grep_re *re)
+{
+  struct grep_op *op, *run = NULL, *best = NULL;
+  size_t len = 0, bestlen = 0, i;
+
+  for (op = re->ops; ; op++) {
+    if (op->kind == GREP_OP_LIT && !op->star) {
+      if (run == NULL) {
+        run = op;
+        len = 0;
+      }
+      len++;
+      continue;
+    }
+    if (run != NULL && len > bestlen) {
+      best = run;
+      bestlen = len;
+    }
+    run = NULL;
+    if (op->kind == GREP_OP_END) {
+      break;
+    }
+  }
+  re->lit = malloc(bestlen + 1);
+  if (!re->lit) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < bestlen; i++) {
+    re->lit[i] = best[i].ch;
+  }
+  re->litlen = bestlen;
+}
+
+/*
+  Compile a basic regular expression.  Returns -1 on a syntax error.
+ */
+static int grep_compile(struct grep_re *re, const char *pat, int fixed)
+{
+  size_t n = strlen(pat);
+  const char *next;
+  int i = 0;
+
+  memset(re, 0, sizeof(*re));
+  if (fixed) {
+    re->fixed = 1;
+    re->lit = (unsigned char *)strdup(pat);
+    if (!re->lit) {
+      fprintf(stderr, "soshell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+    re->litlen = n;
+    return 0;
+  }
+
+  re->ops = calloc(n + 1, sizeof(*re->ops));
+  if (!re->ops) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  if (*pat == '^') {
+    re->bol = 1;
+    pat++;
+  }
+  while (*pat != '\0') {
+    if (*pat == '$' && pat[1] == '\0') {
+      re->eol = 1;
+      break;
+    }
+    // A leading '*' is an ordinary character, as in POSIX BREs.
+    if (*pat == '*' && i > 0) {
+      re->ops[i - 1].star = 1;
+      pat++;
+      continue;
+    }
+    if (*pat == '.') {
+      re->ops[i++].kind = GREP_OP_ANY;
+      pat++;
+    } else if (*pat == '[') {
+      next = grep_parse_class(pat + 1, &re->ops[i]);
+      if (next == NULL) {
+        fprintf(stderr, "soshell: grep: unterminated [\n");
+        return -1;
+      }
+      i++;
+      pat = next;
+    } else {
+      if (*pat == '\\' && pat[1] != '\0') {
+        pat++;
+      }
+      re->ops[i].kind = GREP_OP_LIT;
+      re->ops[i++].ch = (unsigned char)*pat++;
+    }
+  }
+  re->ops[i].kind = GREP_OP_END;
+  grep_required_literal(re);
+  // A pattern that is one literal needs nothing but the search.
+  re->fixed = (!re->bol && !re->eol && (size_t)i == re->litlen);
+  return 0;
+}
+
+static void grep_free(struct grep_re *re)
+{
+  free(re->ops);
+  free(re->lit);
+}
+
+static int grep_op_matches(const struct grep_op *op, unsigned char c)
+{
+  if (op->kind == GREP_OP_LIT) {
+    return c == op->ch;
+  }
+  if (op->kind == GREP_OP_ANY) {
+    return 1;
+  }
+  return (op->set[c >> 3] >> (c & 7)) & 1;
+}
+
+static int grep_match_here(const struct grep_re *re, const struct grep_op *op,
+                           const unsigned char *s, const unsigned char *end)
+{
+  const unsigned char *t;
+
+  for (; op->kind != GREP_OP_END; op++) {
+    if (op->star) {
+      // Longest run first, then give back one character at a time.
+      for (t = s; t < end && grep_op_matches(op, *t); t++) {}
+      for (;; t--) {
+        if (grep_match_here(re, op + 1, t, end)) {
+          return 1;
+        }
+        if (t == s) {
+          return 0;
+        }
+      }
+    }
+    if (s == end || !grep_op_matches(op, *s)) {
+      return 0;
+    }
+    s++;
+  }
+  return !re->eol || s == end;
+}
+
+/*
+  Run the matcher on one line [s, end), without its newline.
+ */
+static int grep_match_re(const struct grep_re *re, const unsigned char *s,
+                         const unsigned char *end)
+{
+  const struct grep_op *op = re->ops;
+
+  if (re->bol) {
+    return grep_match_here(re, op, s, end);
+  }
+  if (op->kind == GREP_OP_LIT && !op->star) {
+    // Only positions holding the first character can start a match.
+    while ((s = memchr(s, op->ch, end - s)) != NULL) {
+      if (grep_match_here(re, op, s, end)) {
+        return 1;
+      }
+      s++;
+    }
+    return 0;
+  }
+  for (;; s++) {
+    if (grep_match_here(re, op, s, end)) {
+      return 1;
+    }
+    if (s == end) {
+      return 0;
+    }
+  }
+}
+
+/*
+  Match one line, looking for the required literal first.
+ */
+static int grep_match_line(const struct grep_re *re, const unsigned char *s,
+                           const unsigned char *end)
+{
+  if (re->litlen > 0 && grep_find()(s, end - s, re->lit, re->litlen) == NULL) {
+    return 0;
+  }
+  return re->fixed || grep_match_re(re, s, end);
+}
+
+struct grep_file {
+  const char *name;
+  const struct grep_opts *opts;
+  uint64_t lineno;         /* number of the line at 'counted' */
+  const unsigned char *counted;
+  uint64_t matches;
+};
+
+static void grep_emit(struct grep_file *f, const unsigned char *line,
+                      const unsigned char *end)
+{
+  const unsigned char *p;
+
+  f->matches++;
+  if (f->opts->count || f->opts->first) {
+    return;
+  }
+  if (f->opts->prefix) {
+    soshell_out_printf("%s:", f->name);
+  }
+  if (f->opts->number) {
+    for (p = f->counted; (p = memchr(p, '\n', line - p)) != NULL; p++) {
+      f->lineno++;
+    }
+    f->counted = line;
+    soshell_out_printf("%llu:", (unsigned long long)f->lineno);
+  }
+  soshell_out_write((const char *)line, end - line);
+  soshell_out_write("\n", 1);
+}
+
+/*
+  Process the lines in [buf, end).  Every line ends in a newline inside
+  the range, except the last one at end of file.
+ */
+static void grep_lines(const struct grep_re *re, struct grep_file *f,
+                       const unsigned char *buf, const unsigned char *end)
+{
+  const unsigned char *p = buf, *hit, *line, *eol;
+
+  if (re->litlen > 0 && !f->opts->invert) {
+    // Jump from one occurrence of the literal to the next.
+    while (p < end && (hit = grep_find()(p, end - p, re->lit, re->litlen)) != NULL) {
+      line = memrchr(p, '\n', hit - p);
+      line = line ? line + 1 : p;
+      eol = memchr(hit, '\n', end - hit);
+      if (eol == NULL) {
+        eol = end;
+      }
+      if (re->fixed || grep_match_re(re, line, eol)) {
+        grep_emit(f, line, eol);
+        if (f->opts->first) {
+          return;
+        }
+      }
+      p = eol + 1;
+    }
+    return;
+  }
+  for (; p < end; p = eol + 1) {
+    eol = memchr(p, '\n', end - p);
+    if (eol == NULL) {
+      eol = end;
+    }
+    if (grep_match_line(re, p, eol) != f->opts->invert) {
+      grep_emit(f, p, eol);
+      if (f->opts->first) {
+        return;
+      }
+    }
+  }
+}
+
+static int grep_fd(const struct grep_re *re, struct grep_file *f, int fd)
+{
+  size_t cap = GREP_BUFSIZE, len = 0, keep;
+  unsigned char *buf = malloc(cap), *last;
+  ssize_t n;
+  int ret = 0;
+
+  if (!buf) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  for (;;) {
+    if (len == cap) {
+      // One line longer than the buffer.
+      cap *= 2;
+      buf = realloc(buf, cap);
+      if (!buf) {
+        fprintf(stderr, "soshell: allocation error\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    n = read(fd, buf + len, cap - len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      ret = (int)n;
+      break;
+    }
+    len += n;
+    soshell_job_yield();
+    last = memrchr(buf + len - n, '\n', n);
+    if (last == NULL) {
+      continue;
+    }
+    last++;
+    f->counted = buf;
+    grep_lines(re, f, buf, last);
+    if (f->opts->first && f->matches > 0) {
+      free(buf);
+      return 0;
+    }
+    if (f->opts->number) {
+      // Count what is left of this buffer before it goes.
+      for (; f->counted < last; f->counted++) {
+        f->lineno += (*f->counted == '\n');
+      }
+    }
+    keep = buf + len - last;
+    memmove(buf, last, keep);
+    len = keep;
+  }
+  if (len > 0) {
+    f->counted = buf;
+    grep_lines(re, f, buf, buf + len);
+  }
+  free(buf);
+  return ret;
+}
+
+/**
+   @brief Builtin command: print lines matching a pattern.
+   @param args List of args.  Options -F, -v, -c, -n, -l, -q, then the
+   pattern, then files; no files or "-" means standard input.
+   @return Always returns 1, to continue executing.
+ */
+int soshell_grep(char **args)
+{
+  struct grep_opts opts;
+  struct grep_file f;
+  struct grep_re re;
+  int fixed = 0, i, fd, nfiles, matched = 0, error = 0;
+  const char *opt;
+  char *none[] = { "-", NULL };
+  char **files;
+
+  memset(&opts, 0, sizeof(opts));
+  for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+    if (strcmp(args[i], "--") == 0) {
+      i++;
+      break;
+    }
+    for (opt = args[i] + 1; *opt; opt++) {
+      if (*opt == 'F') {
+        fixed = 1;
+      } else if (*opt == 'v') {
+        opts.invert = 1;
+      } else if (*opt == 'c') {
+        opts.count = 1;
+      } else if (*opt == 'n') {
+        opts.number = 1;
+      } else if (*opt == 'l') {
+        opts.list = 1;
+      } else if (*opt == 'q') {
+        opts.quiet = 1;
+      } else {
+        fprintf(stderr, "soshell: grep: unknown option -%c\n", *opt);
+        soshell_last_status = 2;
+        return 1;
+      }
+    }
+  }
+  if (args[i] == NULL) {
+    fprintf(stderr, "soshell: grep: expected a pattern\n");
+    soshell_last_status = 2;
+    return 1;
+  }
+  if (grep_compile(&re, args[i], fixed) != 0) {
+    grep_free(&re);
+    soshell_last_status = 2;
+    return 1;
+  }
+  opts.first = opts.list || opts.quiet;
+  files = (args[i + 1] == NULL) ? none : args + i + 1;
+  for (nfiles = 0; files[nfiles] != NULL; nfiles++) {}
+  opts.prefix = (nfiles > 1);
+
+  for (i = 0; i < nfiles; i++) {
+    if (strcmp(files[i], "-") == 0) {
+      fd = soshell_in_fd;
+    } else {
+      fd = open(files[i], O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+        fprintf(stderr, "soshell: grep: %s: %s\n", files[i], strerror(errno));
+        error = 1;
+        continue;
+      }
+    }
+    memset(&f, 0, sizeof(f));
+    f.name = (fd == soshell_in_fd) ? "(standard input)" : files[i];
+    f.opts = &opts;
+    f.lineno = 1;
+    if (grep_fd(&re, &f, fd) != 0) {
+      fprintf(stderr, "soshell: grep: %s: %s\n", files[i], strerror(errno));
+      error = 1;
+    }
+    if (fd != soshell_in_fd) {
+      close(fd);
+    }
+    matched |= (f.matches > 0);
+    if (opts.quiet) {
+      if (matched) {
+        break;
+      }
+    } else if (opts.list && f.matches > 0) {
+      soshell_out_printf("%s\n", f.name);
+    } else if (opts.count && !opts.list) {
+      if (opts.prefix) {
+        soshell_out_printf("%s:", f.name);
+      }
+      soshell_out_printf("%llu\n", (unsigned long long)f.matches);
+    }
+  }
+  grep_free(&re);
+  if (opts.quiet && matched) {
+    soshell_last_status = 0;
+  } else {
+    soshell_last_status = error ? 2 : !matched;
+  }
+  return 1;
+}
@@ -0,0 +1,6 @@
+#ifndef SOSHELL_GREP_H
+#define SOSHELL_GREP_H
+
+int soshell_grep(char **args);
+
+#endif
@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/uio.h>
+
+#include "io.h"
+#include "job.h"
+
+__thread int soshell_in_fd;
+__thread struct soshell_out *soshell_out;
+
+/* Output of builtins run by the shell itself, on its stdout. */
+static struct soshell_out out_stdout = { STDOUT_FILENO, 0, 0, { 0 } };
+
+/**
+   @brief Get the output buffer of the builtin running on this thread.
+   @return The buffer.
+ */
+struct soshell_out *soshell_out_current(void)
+{
+  return soshell_out ? soshell_out : &out_stdout;
+}
+
+/**
+   @brief Create an output buffer for a file descriptor.
+   @param fd The descriptor; it is closed by soshell_out_close().
+   @return The buffer.
+ */
+struct soshell_out *soshell_out_open(int fd)
+{
+  struct soshell_out *out = malloc(sizeof(*out));
+
+  if (!out) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  out->fd = fd;
+  out->error = 0;
+  out->len = 0;
+  return out;
+}
+
+/*
+  Write the buffer followed by data, in one writev where possible.
+ */
+static int out_writev(struct soshell_out *out, const char *data, size_t len)
+{
+  struct iovec iov[2];
+  int n = 0, first = 0;
+  ssize_t done;
+
+  if (out->len > 0) {
+    iov[n].iov_base = out->buf;
+    iov[n++].iov_len = out->len;
+  }
+  if (len > 0) {
+    iov[n].iov_base = (void *)data;
+    iov[n++].iov_len = len;
+  }
+  out->len = 0;
+
+  while (first < n && !out->error) {
+    done = writev(out->fd, iov + first, n - first);
+    if (done < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // Output of a background builtin: let the shell run meanwhile.
+      if (errno == EAGAIN) {
+        soshell_job_wait_fd(out->fd, POLLOUT);
+        continue;
+      }
+      // EPIPE and friends: the reader is gone, stop producing output.
+      out->error = 1;
+      break;
+    }
+    while (first < n && (size_t)done >= iov[first].iov_len) {
+      done -= iov[first++].iov_len;
+    }
+    if (first < n) {
+      iov[first].iov_base = (char *)iov[first].iov_base + done;
+      iov[first].iov_len -= done;
+    }
+  }
+  soshell_job_yield();
+  return out->error ? -1 : 0;
+}
+
+/**
+   @brief Flush and free an output buffer, closing its descriptor.
+   @param out The buffer.
+ */
+void soshell_out_close(struct soshell_out *out)
+{
+  out_writev(out, NULL, 0);
+  close(out->fd);
+  free(out);
+}
+
+/**
+   @brief Append bytes to this thread's builtin output.
+   @param data The bytes.
+   @param len Number of bytes.
+ */
+void soshell_out_write(const char *data, size_t len)
+{
+  struct soshell_out *out = soshell_out_current();
+
+  if (out->error) {
+    return;
+  }
+  if (SOSHELL_OUT_BUFSIZE - out->len >= len) {
+    memcpy(out->buf + out->len, data, len);
+    out->len += len;
+    return;
+  }
+  out_writev(out, data, len);
+}
+
+/**
+   @brief Append a string to this thread's builtin output.
+   @param s The string.
+ */
+void soshell_out_puts(const char *s)
+{
+  soshell_out_write(s, strlen(s));
+}
+
+/**
+   @brief Append formatted text to this thread's builtin output.
+   @param fmt printf format.
+ */
+void soshell_out_printf(const char *fmt, ...)
+{
+  struct soshell_out *out = soshell_out_current();
+  size_t room = SOSHELL_OUT_BUFSIZE - out->len;
+  va_list ap;
+  char *big;
+  int n;
+
+  if (out->error) {
+    return;
+  }
+  va_start(ap, fmt);
+  n = vsnprintf(out->buf + out->len, room, fmt, ap);
+  va_end(ap);
+  if (n < 0) {
+    return;
+  }
+  if ((size_t)n < room) {
+    out->len += n;
+    return;
+  }
+
+  // Did not fit: format separately and write it out with the buffer.
+  big = malloc(n + 1);
+  if (!big) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  va_start(ap, fmt);
+  vsnprintf(big, n + 1, fmt, ap);
+  va_end(ap);
+  out_writev(out, big, n);
+  free(big);
+}
+
+/**
+   @brief Write out everything buffered on this thread.
+   @return 0 on success, -1 if output could not be written.
+ */
+int soshell_out_flush(void)
+{
+  struct soshell_out *out = soshell_out_current();
+  int ret;
+
+  if (out->len == 0) {
+    ret = out->error ? -1 : 0;
+  } else {
+    ret = out_writev(out, NULL, 0);
+  }
+  // The shell's own stdout recovers for the next command.
+  if (out == &out_stdout) {
+    out->error = 0;
+  }
+  return ret;
+}
@@ -0,0 +1,37 @@
+#ifndef SOSHELL_IO_H
+#define SOSHELL_IO_H
+
+#include <stddef.h>
+
+#define SOSHELL_OUT_BUFSIZE (64 * 1024)
+
+/*
+  Buffered output of a builtin.  Output accumulates here and reaches
+  the file descriptor in as few write/writev calls as possible: when the
+  buffer fills, when the command ends, and before the shell forks.
+ */
+struct soshell_out {
+  int fd;
+  int error;               /* a write failed; further output is dropped */
+  size_t len;
+  char buf[SOSHELL_OUT_BUFSIZE];
+};
+
+/*
+  Standard input and output of the builtin running on this thread.  A
+  builtin inside a pipeline runs on its own thread with these pointing
+  at its pipe ends; elsewhere they are the shell's own stdin/stdout.
+ */
+extern __thread int soshell_in_fd;
+extern __thread struct soshell_out *soshell_out;
+
+struct soshell_out *soshell_out_current(void);
+struct soshell_out *soshell_out_open(int fd);
+void soshell_out_close(struct soshell_out *out);
+void soshell_out_write(const char *data, size_t len);
+void soshell_out_puts(const char *s);
+void soshell_out_printf(const char *fmt, ...)
+  __attribute__((format(printf, 1, 2)));
+int soshell_out_flush(void);
+
+#endif
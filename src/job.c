@@ -0,0 +1,443 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "job.h"
+#include "builtin.h"
+#include "io.h"
+#include "pathcache.h"
+#include "pipeline.h"
+#include "shell.h"
+#include "stats.h"
+#include "trace.h"
+#include "var.h"
+
+/*
+  A builtin started with & does not get a thread or a process: it runs
+  as a coroutine, on its own stack, on the shell's thread.  It has its
+  own output buffer on the shell's stdout and reads /dev/null,
+  as background commands do in a shell without job control.  The shell
+  switches these, with soshell_out and soshell_in_fd, on every switch.
+
+  A job gives up the thread at I/O: each time it reads a buffer of
+  input or writes out a buffer of output, and when its output would
+  block or it waits for the commands it ran (xargs), in which case it
+  is only resumed once poll() says the output is writable or a
+  command's pidfd readable.  The shell runs the jobs while it waits for its next line
+  of input (soshell_job_poll), polling its input together with the
+  descriptors the jobs wait on, so a prompt stays responsive while ls
+  or grep run behind it.  Builtins that hand their work to a worker
+  pool hold the thread until the pool is done.
+
+  External commands started with & are forked with /dev/null as input,
+  and reaped when the shell next runs its jobs.  Whatever is still
+  running when the shell is done with its input is waited for.
+ */
+
+#define JOB_STACK (1024 * 1024)
+
+struct job {
+  int id;
+  char **argv;             /* one allocation, with the strings */
+  soshell_builtin_fn builtin;
+  pid_t pid;               /* external commands */
+  ucontext_t ctx;
+  char *stack;
+  struct soshell_out *out;
+  int in_fd;
+  struct pollfd *wait;     /* on the job's stack, while it waits */
+  int nwait;               /* 0 when runnable */
+  int done;
+  struct job *next;
+};
+
+static struct job *job_list;
+static int job_next_id = 1;
+static int job_notify;     /* report jobs, for an interactive shell */
+static ucontext_t job_scheduler;
+static __thread struct job *job_current;
+
+/*
+  Copy a command, which lives in the per-command arena, so it survives
+  the line that started it.
+ */
+static char **job_copy_args(char **args)
+{
+  size_t len = 0;
+  char **argv, *p;
+  int i, n;
+
+  for (n = 0; args[n] != NULL; n++) {
+    len += strlen(args[n]) + 1;
+  }
+  argv = malloc((n + 1) * sizeof(char *) + len);
+  if (!argv) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  p = (char *)(argv + n + 1);
+  for (i = 0; i < n; i++) {
+    argv[i] = p;
+    p = stpcpy(p, args[i]) + 1;
+  }
+  argv[n] = NULL;
+  return argv;
+}
+
+static void job_main(void)
+{
+  struct job *job = job_current;
+  uint64_t t = soshell_trace_begin();
+
+  job->builtin(job->argv);
+  soshell_trace_end("builtin", job->argv[0], t);
+  soshell_out_close(job->out);
+  job->out = NULL;
+  soshell_out = NULL;
+  job->done = 1;
+  // Returning resumes the scheduler, through uc_link.
+}
+
+/*
+  The job's own descriptor for the shell's stdout.  Writes to a pipe or
+  a terminal must not block the shell, but O_NONBLOCK cannot be set on
+  a descriptor the shell shares: such outputs are opened again, which
+  gives a separate open file.  A regular file never blocks, and is only
+  dup'ed, to share its offset.
+ */
+static int job_open_output(void)
+{
+  struct stat st;
+  int fd;
+
+  if (fstat(STDOUT_FILENO, &st) == 0 && !S_ISREG(st.st_mode)) {
+    fd = open("/proc/self/fd/1", O_WRONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+    if (fd >= 0) {
+      return fd;
+    }
+  }
+  return fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+}
+
+static int job_start_builtin(struct job *job)
+{
+  int out_fd;
+
+  job->stack = mmap(NULL, JOB_STACK, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (job->stack == MAP_FAILED || getcontext(&job->ctx) != 0) {
+    if (job->stack != MAP_FAILED) {
+      munmap(job->stack, JOB_STACK);
+    }
+    return -1;
+  }
+  // A guard page: overflowing the stack faults instead of corrupting.
+  mprotect(job->stack, getpagesize(), PROT_NONE);
+  out_fd = job_open_output();
+  job->in_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  if (out_fd < 0 || job->in_fd < 0) {
+    if (out_fd >= 0) {
+      close(out_fd);
+    }
+    if (job->in_fd >= 0) {
+      close(job->in_fd);
+    }
+    munmap(job->stack, JOB_STACK);
+    return -1;
+  }
+  job->out = soshell_out_open(out_fd);
+  job->ctx.uc_stack.ss_sp = job->stack;
+  job->ctx.uc_stack.ss_size = JOB_STACK;
+  job->ctx.uc_link = &job_scheduler;
+  makecontext(&job->ctx, job_main, 0);
+  return 0;
+}
+
+static pid_t job_start_external(char **args)
+{
+  char path[4096];
+  int found = (soshell_path_lookup(args[0], path, sizeof(path)) == 0);
+  int fd;
+  pid_t pid;
+
+  soshell_out_flush();
+  pid = fork();
+  if (pid == 0) {
+    fd = open("/dev/null", O_RDONLY);
+    if (fd >= 0) {
+      dup2(fd, STDIN_FILENO);
+    }
+    soshell_path_exec(found ? path : NULL, args);
+    perror("soshell");
+    exit(127);
+  }
+  if (pid > 0) {
+    soshell_counters.forks++;
+  }
+  return pid;
+}
+
+/**
+   @brief Start a command in the background.
+   @param args Null terminated list of arguments, without the &.
+   @return Always returns 1, to continue execution.
+ */
+int soshell_job_start(char **args)
+{
+  struct job *job, **tail;
+
+  if (args[0] == NULL || soshell_var_is_assignment(args[0])) {
+    // Nothing to run, or assignments that would be lost with the job.
+    return 1;
+  }
+  if (soshell_is_pipeline(args) || strcmp(args[0], "time") == 0) {
+    fprintf(stderr, "soshell: &: only simple commands can run in the background\n");
+    return 1;
+  }
+  if (soshell_builtin_changes_shell(args[0])) {
+    fprintf(stderr, "soshell: &: %s cannot run in the background\n", args[0]);
+    return 1;
+  }
+
+  job = calloc(1, sizeof(*job));
+  if (!job) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  job->argv = job_copy_args(args);
+  job->builtin = soshell_find_builtin(args[0]);
+  if (job->builtin != NULL) {
+    soshell_counters.builtins++;
+    if (job_start_builtin(job) != 0) {
+      fprintf(stderr, "soshell: &: %s\n", strerror(errno));
+      free(job->argv);
+      free(job);
+      return 1;
+    }
+  } else {
+    soshell_counters.external++;
+    job->pid = job_start_external(job->argv);
+    if (job->pid < 0) {
+      perror("soshell");
+      free(job->argv);
+      free(job);
+      return 1;
+    }
+  }
+
+  if (job_list == NULL) {
+    job_next_id = 1;
+    job_notify = isatty(STDIN_FILENO);
+  }
+  job->id = job_next_id++;
+  for (tail = &job_list; *tail != NULL; tail = &(*tail)->next) {}
+  *tail = job;
+  if (job_notify) {
+    if (job->pid > 0) {
+      fprintf(stderr, "[%d] %d\n", job->id, (int)job->pid);
+    } else {
+      fprintf(stderr, "[%d]\n", job->id);
+    }
+  }
+  return 1;
+}
+
+/**
+   @brief Whether any background job is still running.
+   @return 1 if there is one, 0 otherwise.
+ */
+int soshell_jobs_active(void)
+{
+  return job_list != NULL;
+}
+
+/**
+   @brief In a background builtin, let the shell and the other jobs run.
+   Elsewhere it does nothing.
+ */
+void soshell_job_yield(void)
+{
+  struct job *job = job_current;
+
+  if (job != NULL) {
+    swapcontext(&job->ctx, &job_scheduler);
+  }
+}
+
+/**
+   @brief Wait until one of fds is ready, as poll() with no timeout.  A
+   background builtin is suspended meanwhile, letting the shell run;
+   elsewhere this blocks.
+   @param fds The descriptors and the events to wait for.  revents is
+   only set when this returns at once.
+   @param n Number of descriptors.
+ */
+void soshell_job_wait_fds(struct pollfd *fds, int n)
+{
+  struct job *job = job_current;
+
+  if (job == NULL) {
+    while (poll(fds, n, -1) < 0 && errno == EINTR) {}
+    return;
+  }
+  if (poll(fds, n, 0) != 0) {
+    return;
+  }
+  job->wait = fds;
+  job->nwait = n;
+  soshell_job_yield();
+}
+
+/**
+   @brief Wait until fd is ready for events, as soshell_job_wait_fds().
+   @param fd The descriptor.
+   @param events poll() events to wait for.
+ */
+void soshell_job_wait_fd(int fd, short events)
+{
+  struct pollfd pfd = { fd, events, 0 };
+
+  soshell_job_wait_fds(&pfd, 1);
+}
+
+/*
+  Run a builtin job until it yields or ends.
+ */
+static void job_resume(struct job *job)
+{
+  struct soshell_out *saved_out = soshell_out;
+  int saved_in = soshell_in_fd, saved_status = soshell_last_status;
+
+  soshell_out = job->out;
+  soshell_in_fd = job->in_fd;
+  job_current = job;
+  swapcontext(&job_scheduler, &job->ctx);
+  job_current = NULL;
+  soshell_out = saved_out;
+  soshell_in_fd = saved_in;
+  // What the job did is not the status of the shell's last command.
+  soshell_last_status = saved_status;
+}
+
+static void job_free(struct job *job)
+{
+  if (job->builtin != NULL) {
+    close(job->in_fd);
+    munmap(job->stack, JOB_STACK);
+  }
+  if (job_notify) {
+    fprintf(stderr, "[%d] Done %s\n", job->id, job->argv[0]);
+  }
+  free(job->argv);
+  free(job);
+}
+
+/*
+  Give every runnable job one turn, and reap the finished ones.
+  Returns the number of builtin jobs left that are runnable.
+ */
+static int job_step(void)
+{
+  struct job **p, *job;
+  int status, runnable = 0;
+
+  for (p = &job_list; (job = *p) != NULL;) {
+    if (job->builtin != NULL && job->nwait == 0) {
+      job_resume(job);
+      runnable += !job->done && job->nwait == 0;
+    } else if (job->builtin == NULL && !job->done &&
+               waitpid(job->pid, &status, WNOHANG) == job->pid) {
+      job->done = 1;
+    }
+    if (job->done) {
+      *p = job->next;
+      job_free(job);
+    } else {
+      p = &job->next;
+    }
+  }
+  return runnable;
+}
+
+/**
+   @brief Run the background jobs until fd has input, or with fd -1,
+   until they have all finished.
+   @param fd The shell's input, or -1.
+ */
+void soshell_job_poll(int fd)
+{
+  struct pollfd *pfd;
+  struct job *job, **waiting;
+  int n, i, j, runnable, status;
+
+  if (job_current != NULL) {
+    // A job cannot wait for the jobs.
+    return;
+  }
+  while (job_list != NULL) {
+    soshell_out_flush();
+    runnable = job_step();
+    for (n = 1, job = job_list; job != NULL; job = job->next) {
+      n += job->nwait;
+    }
+    pfd = malloc(n * sizeof(*pfd));
+    waiting = malloc(n * sizeof(*waiting));
+    if (!pfd || !waiting) {
+      fprintf(stderr, "soshell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+    n = 0;
+    if (fd >= 0) {
+      pfd[n].fd = fd;
+      pfd[n].revents = 0;
+      pfd[n++].events = POLLIN;
+    }
+    for (job = job_list; job != NULL; job = job->next) {
+      for (j = 0; j < job->nwait; j++) {
+        waiting[n] = job;
+        pfd[n].fd = job->wait[j].fd;
+        pfd[n++].events = job->wait[j].events;
+      }
+    }
+    if (job_list != NULL && n == 0 && runnable == 0) {
+      // Only commands are left, and nothing else to wait for.
+      job = job_list;
+      while (waitpid(job->pid, &status, 0) < 0 && errno == EINTR) {}
+      job->done = 1;
+      n = -1;
+    } else if (job_list != NULL && poll(pfd, n, runnable ? 0 : -1) < 0) {
+      n = -1;
+    }
+    for (i = (fd >= 0); i < n; i++) {
+      if (pfd[i].revents != 0) {
+        waiting[i]->nwait = 0;
+      }
+    }
+    i = (fd >= 0 && n > 0 && pfd[0].revents != 0);
+    free(pfd);
+    free(waiting);
+    if (i) {
+      return;
+    }
+  }
+}
+
+/**
+   @brief Builtin command: wait for the background jobs to finish.
+   @param args List of args.  Not examined.
+   @return Always returns 1, to continue executing.
+ */
+int soshell_wait(char **args)
+{
+  soshell_job_poll(-1);
+  return 1;
+}
@@ -0,0 +1,18 @@
+#ifndef SOSHELL_JOB_H
+#define SOSHELL_JOB_H
+
+#include <poll.h>
+
+/*
+  Background jobs, cmd &.  A builtin runs as a coroutine on the shell's
+  own thread; an external command is forked and not waited for.
+ */
+int soshell_job_start(char **args);
+int soshell_jobs_active(void);
+void soshell_job_poll(int fd);
+void soshell_job_yield(void);
+void soshell_job_wait_fds(struct pollfd *fds, int n);
+void soshell_job_wait_fd(int fd, short events);
+int soshell_wait(char **args);
+
+#endif
@@ -1,11 +1,44 @@
+#define _GNU_SOURCE
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/utsname.h>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+
+#include "alias.h"
+#include "arena.h"
+#include "arith.h"
+#include "builtin.h"
+#include "daemon.h"
+#include "cat.h"
+#include "cp.h"
+#include "dircache.h"
+#include "du.h"
+#include "find.h"
+#include "glob.h"
+#include "grep.h"
+#include "io.h"
+#include "job.h"
+#include "pathcache.h"
+#include "pipeline.h"
+#include "rc.h"
+#include "shell.h"
+#include "sort.h"
+#include "startup.h"
+#include "stats.h"
+#include "timecmd.h"
+#include "trace.h"
+#include "var.h"
+#include "wc.h"
+#include "xargs.h"
+#include "zygote.h"
 
 #define ANSI_COLOR_RED     "\x1b[31m"
 #define ANSI_COLOR_GREEN   "\x1b[32m"
@@ -22,6 +55,7 @@ int soshell_cd(char **args);
 int soshell_ls(char **args);
 int soshell_rm(char **args);
 int soshell_help(char **args);
+int soshell_exec(char **args);
 int soshell_exit(char **args);
 
 /*
@@ -31,7 +65,20 @@ char *builtin_str[] = {
   "cd",
   "ls",
   "rm",
+  "cat",
+  "cp",
+  "wc",
+  "grep",
+  "du",
+  "find",
+  "sort",
+  "xargs",
+  "alias",
+  "unalias",
+  "stats",
   "help",
+  "exec",
+  "wait",
   "exit"
 };
 
@@ -39,7 +86,20 @@ int (*builtin_func[]) (char **) = {
   &soshell_cd,
   &soshell_ls,
   &soshell_rm,
+  &soshell_cat,
+  &soshell_cp,
+  &soshell_wc,
+  &soshell_grep,
+  &soshell_du,
+  &soshell_find,
+  &soshell_sort,
+  &soshell_xargs,
+  &soshell_alias,
+  &soshell_unalias,
+  &soshell_stats,
   &soshell_help,
+  &soshell_exec,
+  &soshell_wait,
   &soshell_exit
 };
 
@@ -47,6 +107,45 @@ int soshell_num_builtins() {
   return sizeof(builtin_str) / sizeof(char *);
 }
 
+/**
+   @brief Look up a builtin command by name.
+   @param name The command name.
+   @return The builtin's function, or NULL if name is not a builtin.
+ */
+soshell_builtin_fn soshell_find_builtin(const char *name)
+{
+  int i;
+
+  for (i = 0; i < soshell_num_builtins(); i++) {
+    if (strcmp(name, builtin_str[i]) == 0) {
+      return builtin_func[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+   @brief Whether a builtin acts on the shell itself: its directory, its
+   aliases, its jobs or its process.  Such a builtin only works run by
+   the shell, not in a pipeline stage or a background job.
+   @param name The command name.
+   @return 1 if it does, 0 otherwise.
+ */
+int soshell_builtin_changes_shell(const char *name)
+{
+  static const char *const names[] = {
+    "cd", "alias", "unalias", "exec", "wait", "exit"
+  };
+  size_t i;
+
+  for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (strcmp(name, names[i]) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
 /*
   Builtin function implementations.
 */
@@ -68,17 +167,6 @@ int soshell_cd(char **args)
   return 1;
 }
 
-int get_next(DIR* stream) {
-  struct dirent* entry = readdir(stream);
-  if(entry == NULL) {
-    closedir(stream);
-    return 0;
-  }
-
-  printf("%s\n", entry->d_name);
-  return 1;
-}
-
 /**
    @brief Builtin command: list directory
    @param args List of args. args[0] is "ls". args[1] is the directory
@@ -86,19 +174,22 @@ int get_next(DIR* stream) {
 **/
 int soshell_ls(char **args)
 {
-  DIR* stream;
+  struct soshell_dirlist *list;
+  size_t i;
 
-  if(args[1] == NULL) {
-    stream = opendir(".");
-  } else {
-    stream = opendir(args[1]);
-    if(stream == NULL) {
-      printf("Unknown directory %s\n", args[1]);
-      return 1;
+  list = soshell_dircache_get(args[1] == NULL ? "." : args[1]);
+  if(list == NULL) {
+    if(args[1] != NULL) {
+      soshell_out_printf("Unknown directory %s\n", args[1]);
     }
+    return 1;
   }
 
-  while(get_next(stream)) {}
+  for(i = 0; i < list->n; i++) {
+    soshell_out_puts(list->ents[i].name);
+    soshell_out_write("\n", 1);
+  }
+  soshell_dircache_put(list);
 
   return 1;
 }
@@ -110,13 +201,13 @@ int soshell_ls(char **args)
 */
 int soshell_rm(char **args) {
   if(args[1] == NULL) {
-    printf("You must provide a file\n");
+    soshell_out_puts("You must provide a file\n");
     return 1;
   }
 
   int ret = remove(args[1]);
   if(ret != 0) {
-    printf("Could not remove file.\n");
+    soshell_out_puts("Could not remove file.\n");
   }
 
   return 1;
@@ -130,15 +221,47 @@ int soshell_rm(char **args) {
 int soshell_help(char **args)
 {
   int i;
-  printf("Soviet Linux soshell\n");
-  printf("Type program names and arguments, and hit enter.\n");
-  printf("The following are built in:\n");
+  soshell_out_puts("Soviet Linux soshell\n");
+  soshell_out_puts("Type program names and arguments, and hit enter.\n");
+  soshell_out_puts("The following are built in:\n");
 
   for (i = 0; i < soshell_num_builtins(); i++) {
-    printf("  %s\n", builtin_str[i]);
+    soshell_out_printf("  %s\n", builtin_str[i]);
   }
 
-  printf("Use the man command for information on other programs.\n");
+  soshell_out_puts("Use the man command for information on other programs.\n");
+  return 1;
+}
+
+/*
+  Replace the shell with a program.  Returns only if it could not be
+  run.
+ */
+static void soshell_replace(char **args)
+{
+  char path[4096];
+  int found = (soshell_path_lookup(args[0], path, sizeof(path)) == 0);
+
+  // The program must not inherit the fork server as a child.
+  soshell_zygote_stop();
+  soshell_out_flush();
+  fflush(NULL);
+  soshell_path_exec(found ? path : NULL, args);
+}
+
+/**
+   @brief Builtin command: run a program in place of the shell.
+   @param args List of args.  args[0] is "exec", then the program and
+   its arguments.
+   @return 1 if the program could not be run, to continue executing.
+ */
+int soshell_exec(char **args)
+{
+  if (args[1] == NULL) {
+    return 1;
+  }
+  soshell_replace(args + 1);
+  fprintf(stderr, "soshell: exec: %s: %s\n", args[1], strerror(errno));
   return 1;
 }
 
@@ -161,27 +284,98 @@ int soshell_launch(char **args)
 {
   pid_t pid;
   int status;
+  char path[4096], byte;
+  int found = (soshell_path_lookup(args[0], path, sizeof(path)) == 0);
+  int exec_fd[2] = { -1, -1 };
+  uint64_t t, spawn;
+
+  // Anything a builtin printed must not be duplicated in the child.
+  soshell_out_flush();
+  if (soshell_zygote_run(found ? path : NULL, args, &status) == 0) {
+    soshell_record_status(status);
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+      soshell_counters.exec_failures++;
+    }
+    return 1;
+  }
 
+  /*
+    When tracing, the child holds the write end of a close-on-exec
+    pipe: the parent's read returns at the child's execve().
+   */
+  if (soshell_trace_enabled && pipe2(exec_fd, O_CLOEXEC) != 0) {
+    exec_fd[0] = exec_fd[1] = -1;
+  }
+  t = soshell_trace_begin();
+  spawn = soshell_stats_spawn_begin();
   pid = fork();
   if (pid == 0) {
     // Child process
-    if (execvp(args[0], args) == -1) {
-      perror("soshell");
+    if (exec_fd[0] >= 0) {
+      close(exec_fd[0]);
     }
-    exit(EXIT_FAILURE);
+    soshell_path_exec(found ? path : NULL, args);
+    perror("soshell");
+    exit(127);
   } else if (pid < 0) {
     // Error forking
     perror("soshell");
+    soshell_last_status = 1;
   } else {
     // Parent process
+    soshell_stats_spawn_end(spawn);
+    soshell_counters.forks++;
+    soshell_trace_end("fork", args[0], t);
+    if (exec_fd[0] >= 0) {
+      t = soshell_trace_begin();
+      close(exec_fd[1]);
+      exec_fd[1] = -1;
+      while (read(exec_fd[0], &byte, 1) < 0 && errno == EINTR) {}
+      soshell_trace_end("exec", args[0], t);
+    }
+    t = soshell_trace_begin();
     do {
       waitpid(pid, &status, WUNTRACED);
     } while (!WIFEXITED(status) && !WIFSIGNALED(status));
+    soshell_trace_end("wait", args[0], t);
+    soshell_record_status(status);
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+      soshell_counters.exec_failures++;
+    }
+  }
+  if (exec_fd[0] >= 0) {
+    close(exec_fd[0]);
+  }
+  if (exec_fd[1] >= 0) {
+    close(exec_fd[1]);
   }
 
   return 1;
 }
 
+__thread int soshell_last_status;
+
+/**
+   @brief Record the status of a command the shell waited for.
+   @param wstatus The status from waitpid().
+ */
+void soshell_record_status(int wstatus)
+{
+  if (WIFEXITED(wstatus)) {
+    soshell_last_status = WEXITSTATUS(wstatus);
+  } else if (WIFSIGNALED(wstatus)) {
+    soshell_last_status = 128 + WTERMSIG(wstatus);
+  }
+}
+
+/*
+  soshell_tail_exec is set by main(), so that soshell -c and scripts
+  exec their last command; soshell_at_tail marks the line being run as
+  the last one.
+ */
+static int soshell_tail_exec;
+static int soshell_at_tail;
+
 /**
    @brief Execute shell built-in or launch program.
    @param args Null terminated list of arguments.
@@ -189,38 +383,92 @@ int soshell_launch(char **args)
  */
 int soshell_execute(char **args)
 {
-  int i;
+  int i, tail = soshell_at_tail;
+  soshell_builtin_fn builtin;
+  uint64_t t;
 
+  // Only the command of the line itself, not one run by time.
+  soshell_at_tail = 0;
   if (args[0] == NULL) {
     // An empty command was entered.
     return 1;
   }
+  // Commands that are waited for record their own status.
+  soshell_last_status = 0;
 
-  for (i = 0; i < soshell_num_builtins(); i++) {
-    if (strcmp(args[0], builtin_str[i]) == 0) {
-      return (*builtin_func[i])(args);
+  for (i = 0; args[i] != NULL; i++) {}
+  if (strcmp(args[i - 1], "&") == 0) {
+    args[i - 1] = NULL;
+    return soshell_job_start(args);
+  }
+
+  // time is a keyword: it prefixes a whole pipeline.
+  if (strcmp(args[0], "time") == 0) {
+    return soshell_time(args);
+  }
+
+  if (soshell_is_pipeline(args)) {
+    soshell_counters.pipelines++;
+    return soshell_pipeline(args);
+  }
+
+  // A command made only of NAME=value words sets shell variables.
+  for (i = 0; args[i] != NULL && soshell_var_is_assignment(args[i]); i++) {}
+  if (args[i] == NULL) {
+    soshell_counters.assignments++;
+    for (i = 0; args[i] != NULL; i++) {
+      soshell_var_assign(args[i]);
     }
+    return 1;
+  }
+
+  builtin = soshell_find_builtin(args[0]);
+  if (builtin != NULL) {
+    soshell_counters.builtins++;
+    t = soshell_trace_begin();
+    i = builtin(args);
+    soshell_trace_end("builtin", args[0], t);
+    return i;
   }
 
+  soshell_counters.external++;
+  /*
+    Nothing is left to do after the last command of -c or a script, so
+    it can take over the shell's process instead of forking.  Not when
+    tracing, as the trace is written when the shell exits, nor while
+    background builtins still run in the shell.
+   */
+  if (tail && soshell_tail_exec && !soshell_trace_enabled && !soshell_jobs_active()) {
+    soshell_replace(args);
+    perror("soshell");
+    exit(127);
+  }
   return soshell_launch(args);
 }
 
 /**
-   @brief Read a line of input from stdin.
-   @return The line from stdin.
+   @brief Read a line of input.
+   @param in The stream to read from.
+   @return The line, without its newline, or NULL at end of input.
  */
-char *soshell_read_line(void)
+char *soshell_read_line(FILE *in)
 {
 #ifdef SOSHELL_USE_STD_GETLINE
   char *line = NULL;
-  ssize_t bufsize = 0; // have getline allocate a buffer for us
-  if (getline(&line, &bufsize, stdin) == -1) {
-    if (feof(stdin)) {
-      exit(EXIT_SUCCESS);  // We received an EOF
-    } else  {
-      perror("soshell: getline\n");
+  size_t bufsize = 0; // have getline allocate a buffer for us
+  ssize_t len = getline(&line, &bufsize, in);
+  if (len == -1) {
+    free(line);
+    if (!feof(in)) {
+      perror("soshell: getline");
       exit(EXIT_FAILURE);
     }
+    return NULL;  // We received an EOF
+  }
+  soshell_counters.read_lines++;
+  soshell_counters.read_bytes += len;
+  if (len > 0 && line[len - 1] == '\n') {
+    line[len - 1] = '\0';
   }
   return line;
 #else
@@ -237,12 +485,16 @@ char *soshell_read_line(void)
 
   while (1) {
     // Read a character
-    c = getchar();
+    c = getc(in);
 
-    if (c == EOF) {
-      exit(EXIT_SUCCESS);
-    } else if (c == '\n') {
+    if (c == EOF && position == 0) {
+      free(buffer);
+      return NULL;
+    } else if (c == '\n' || c == EOF) {
+      // A last line without a newline still counts.
       buffer[position] = '\0';
+      soshell_counters.read_lines++;
+      soshell_counters.read_bytes += position + (c == '\n');
       return buffer;
     } else {
       buffer[position] = c;
@@ -303,32 +555,166 @@ char **soshell_split_line(char *line)
 }
 
 /**
-   @brief Loop getting input and executing it.
+   @brief Expand and execute one line of input.
+   @param line The line, allocated with malloc; it is freed here.
+   @return 1 if the shell should continue running, 0 if it should terminate
+ */
+int soshell_run_line(char *line)
+{
+  char **args, **words;
+  int status;
+  uint64_t t;
+
+  soshell_counters.commands++;
+  t = soshell_trace_begin();
+  if (soshell_arith_expand(&line) != 0) {
+    free(line);
+    return 1;
+  }
+  args = soshell_split_line(line);
+  words = soshell_glob_expand(soshell_alias_expand(args));
+  soshell_trace_end("parse", NULL, t);
+  t = soshell_trace_begin();
+  status = soshell_execute(words);
+  soshell_trace_end("execute", words[0], t);
+
+  free(line);
+  free(args);
+  soshell_arena_reset();
+  return status;
+}
+
+/**
+   @brief Run each line of a string, as given to -c.
+   @param script The lines.
+   @return 1 if the shell should continue running, 0 if it should terminate
+ */
+int soshell_run_string(const char *script)
+{
+  const char *end;
+  char *line;
+  int status = 1;
+
+  while (status && *script != '\0') {
+    end = strchrnul(script, '\n');
+    line = strndup(script, end - script);
+    if (!line) {
+      fprintf(stderr, "soshell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+    script = (*end == '\n') ? end + 1 : end;
+    soshell_at_tail = (*script == '\0');
+    status = soshell_run_line(line);
+  }
+  return status;
+}
+
+/*
+  The host name for the prompt, looked up when the first prompt is
+  shown: scripts and -c never need it.
  */
-void soshell_loop(void)
+static const char *soshell_hostname(void)
 {
- struct utsname buffer;
- if (uname(&buffer) < 0){
-   perror("uname");
-   exit(EXIT_FAILURE);
+  static struct utsname buffer;
+  static int looked_up;
+  uint64_t t;
+
+  if (!looked_up) {
+    t = soshell_startup_now();
+    if (uname(&buffer) < 0) {
+      strcpy(buffer.nodename, "soshell");
+    }
+    looked_up = 1;
+    soshell_startup_phase("uname", t);
   }
+  return buffer.nodename;
+}
+
+/**
+   @brief Loop getting input and executing it.
+   @param in The stream to read commands from.  A prompt is shown only
+   when it is a terminal.
+ */
+void soshell_loop(FILE *in)
+{
   char workdir[100];
   char *line;
-  char **args;
   int status;
+  int interactive = isatty(fileno(in)), regular, c;
+  struct stat st;
+  uint64_t t;
 
-  do {
-    printf(ANSI_COLOR_RED "%s" ANSI_COLOR_RESET,  buffer.nodename);
-    printf(ANSI_COLOR_GREEN " [%s]$ " ANSI_COLOR_RESET, getcwd(workdir, 100));
-    line = soshell_read_line();
-    args = soshell_split_line(line);
-    status = soshell_execute(args);
+  /*
+    Whether a line is the last one is only looked at in a regular file:
+    on a pipe, peeking would hold the line until the next one arrives.
+   */
+  regular = !interactive && fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode);
 
-    free(line);
-    free(args);
+  do {
+    if (interactive) {
+      soshell_out_printf(ANSI_COLOR_RED "%s" ANSI_COLOR_RESET, soshell_hostname());
+      soshell_out_printf(ANSI_COLOR_GREEN " [%s]$ " ANSI_COLOR_RESET, getcwd(workdir, 100));
+    }
+    // The last command's output and this prompt go out in one write.
+    soshell_out_flush();
+    soshell_startup_ready();
+    // Background builtins run while the shell waits for input.
+    if (soshell_jobs_active()) {
+      soshell_job_poll(fileno(in));
+    }
+    t = soshell_trace_begin();
+    line = soshell_read_line(in);
+    soshell_trace_end("read_line", NULL, t);
+    if (line == NULL) {
+      break;
+    }
+    if (regular) {
+      c = getc(in);
+      soshell_at_tail = (c == EOF);
+      ungetc(c, in);
+    }
+    status = soshell_run_line(line);
   } while (status);
 }
 
+/**
+   @brief Run the shell on its arguments: -c 'commands', a script file,
+   or standard input.
+   @param argc Argument count.
+   @param argv Argument vector.
+   @return Exit status for the shell.
+ */
+int soshell_run_args(int argc, char **argv)
+{
+  FILE *script;
+
+  soshell_last_status = 0;
+  if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+    if (argc < 3) {
+      fprintf(stderr, "soshell: -c: option requires an argument\n");
+      return 2;
+    }
+    soshell_startup_ready();
+    soshell_run_string(argv[2]);
+  } else if (argc > 1) {
+    script = fopen(argv[1], "re");
+    if (script == NULL) {
+      fprintf(stderr, "soshell: %s: %s\n", argv[1], strerror(errno));
+      return 127;
+    }
+    soshell_loop(script);
+    fclose(script);
+  } else {
+    soshell_loop(stdin);
+  }
+
+  // Perform any shutdown/cleanup.
+  soshell_job_poll(-1);
+  soshell_out_flush();
+  return soshell_last_status;
+}
+
+#ifndef SOSHELL_NO_MAIN
 /**
    @brief Main entry point.
    @param argc Argument count.
@@ -337,13 +723,41 @@ void soshell_loop(void)
  */
 int main(int argc, char **argv)
 {
-  // Load config files, if any.
+  uint64_t t;
+
+  // soshell --startup-profile ... reports where startup time goes.
+  if (argc > 1 && strcmp(argv[1], "--startup-profile") == 0) {
+    soshell_startup_begin();
+    argv[1] = argv[0];
+    argv++;
+    argc--;
+  }
 
-  // Run command loop.
-  soshell_loop();
+  t = soshell_startup_now();
+  soshell_trace_init();
+  soshell_startup_phase("trace init", t);
 
-  // Perform any shutdown/cleanup.
+  // Run ~/.soshellrc; a daemon runs it once for all its clients.
+  t = soshell_startup_now();
+  if (!soshell_rc_load()) {
+    return EXIT_SUCCESS;
+  }
+  soshell_startup_phase("rc", t);
 
-  return EXIT_SUCCESS;
-}
+  // soshell --daemon [socket] serves soshellc clients instead.
+  if (argc > 1 && strcmp(argv[1], "--daemon") == 0) {
+    return soshell_daemon(argc > 2 ? argv[2] : NULL);
+  }
+
+  // The fork server must be started while the shell is still small.
+  if (getenv("SOSHELL_ZYGOTE") != NULL) {
+    t = soshell_startup_now();
+    soshell_zygote_start();
+    soshell_startup_phase("zygote", t);
+  }
 
+  // Run command loop.
+  soshell_tail_exec = 1;
+  return soshell_run_args(argc, argv);
+}
+#endif
@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "pathcache.h"
+
+/*
+  Where commands were found in PATH.  execvp() tries execve() in every
+  PATH directory in turn, each failure a system call; with the full
+  path remembered a command costs one execve().  The table is emptied
+  whenever PATH changes.  Entries are not checked again: a command that
+  moved makes execv() fail, and the caller then falls back to execvp().
+ */
+
+#define PATHCACHE_BUCKETS 256
+
+struct path_entry {
+  char *name;
+  char *path;
+  struct path_entry *next;
+};
+
+static struct path_entry *path_table[PATHCACHE_BUCKETS];
+static char *path_env;     /* PATH the table was filled for */
+// Builtins in a pipeline run on their own threads.
+static pthread_mutex_t path_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long path_hash(const char *s)
+{
+  uint32_t h = 2166136261u;
+
+  for (; *s; s++) {
+    h = (h ^ (unsigned char)*s) * 16777619u;
+  }
+  return h % PATHCACHE_BUCKETS;
+}
+
+static void path_flush(void)
+{
+  struct path_entry *e, *next;
+  int i;
+
+  for (i = 0; i < PATHCACHE_BUCKETS; i++) {
+    for (e = path_table[i]; e != NULL; e = next) {
+      next = e->next;
+      free(e->name);
+      free(e->path);
+      free(e);
+    }
+    path_table[i] = NULL;
+  }
+}
+
+/*
+  Search PATH the way execvp() does.  Returns a malloc'd path or NULL.
+ */
+static char *path_search(const char *name, const char *path)
+{
+  size_t namelen = strlen(name), dirlen;
+  const char *dir, *end;
+  struct stat st;
+  char *full;
+
+  for (dir = path; ; dir = end + 1) {
+    end = strchrnul(dir, ':');
+    dirlen = end - dir;
+    full = malloc(dirlen + namelen + 3);
+    if (!full) {
+      fprintf(stderr, "soshell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+    // An empty PATH element means the current directory.
+    if (dirlen == 0) {
+      full[0] = '.';
+      dirlen = 1;
+    } else {
+      memcpy(full, dir, dirlen);
+    }
+    full[dirlen] = '/';
+    memcpy(full + dirlen + 1, name, namelen + 1);
+    if (stat(full, &st) == 0 && S_ISREG(st.st_mode) && access(full, X_OK) == 0) {
+      return full;
+    }
+    free(full);
+    if (*end == '\0') {
+      return NULL;
+    }
+  }
+}
+
+/**
+   @brief Find a command in PATH, remembering where it was found.
+   @param name Command name.  Names with a slash are not looked up.
+   @param buf Receives the full path.
+   @param size Size of buf.
+   @return 0 if found, -1 otherwise.
+ */
+int soshell_path_lookup(const char *name, char *buf, size_t size)
+{
+  const char *path = getenv("PATH");
+  struct path_entry *e;
+  unsigned long slot;
+  char *full;
+  int ret = -1;
+
+  if (name[0] == '\0' || strchr(name, '/') != NULL) {
+    return -1;
+  }
+  if (path == NULL) {
+    path = "/bin:/usr/bin";
+  }
+
+  pthread_mutex_lock(&path_lock);
+  if (path_env == NULL || strcmp(path_env, path) != 0) {
+    path_flush();
+    free(path_env);
+    path_env = strdup(path);
+    if (!path_env) {
+      fprintf(stderr, "soshell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  slot = path_hash(name);
+  for (e = path_table[slot]; e != NULL; e = e->next) {
+    if (strcmp(e->name, name) == 0) {
+      break;
+    }
+  }
+  if (e == NULL && (full = path_search(name, path)) != NULL) {
+    e = malloc(sizeof(*e));
+    if (!e || !(e->name = strdup(name))) {
+      fprintf(stderr, "soshell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+    e->path = full;
+    e->next = path_table[slot];
+    path_table[slot] = e;
+  }
+  if (e != NULL && strlen(e->path) < size) {
+    strcpy(buf, e->path);
+    ret = 0;
+  }
+  pthread_mutex_unlock(&path_lock);
+  return ret;
+}
+
+/**
+   @brief Execute a command found by soshell_path_lookup(), falling
+   back to a PATH search.  Takes no lock, so it is safe in a child
+   forked from a threaded shell.  Returns only on failure, like execvp().
+   @param path Full path from soshell_path_lookup(), or NULL.
+   @param args Null terminated list of arguments (including program).
+ */
+void soshell_path_exec(const char *path, char **args)
+{
+  if (path != NULL) {
+    execv(path, args);
+  }
+  execvp(args[0], args);
+}
@@ -0,0 +1,9 @@
+#ifndef SOSHELL_PATHCACHE_H
+#define SOSHELL_PATHCACHE_H
+
+#include <stddef.h>
+
+int soshell_path_lookup(const char *name, char *buf, size_t size);
+void soshell_path_exec(const char *path, char **args);
+
+#endif
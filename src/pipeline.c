@@ -0,0 +1,239 @@
+#define _GNU_SOURCE
+#include <sys/wait.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "pipeline.h"
+#include "arena.h"
+#include "builtin.h"
+#include "io.h"
+#include "pathcache.h"
+#include "shell.h"
+#include "stats.h"
+#include "trace.h"
+
+/*
+  Pipelines, cmd | cmd | ...
+
+  External stages are forked as usual.  Builtin stages are not: each
+  runs on a thread of the shell, writing through its own output buffer
+  on the pipe, so a pipeline made only of builtins never forks.
+  The last stage, if it is a builtin, runs on the shell's own thread.
+  Builtins that act on the shell itself (cd, alias, exec, ...) are
+  refused in a pipeline.
+ */
+
+struct pipeline_stage {
+  char **argv;
+  soshell_builtin_fn builtin;
+  int in_fd;
+  int out_fd;
+  char *path;              /* from the PATH cache, for external stages */
+  pid_t pid;
+  pthread_t thread;
+  int threaded;
+};
+
+/**
+   @brief Check whether a command line contains a pipe.
+   @param args Null terminated list of arguments.
+   @return 1 if it does, 0 otherwise.
+ */
+int soshell_is_pipeline(char **args)
+{
+  int i;
+
+  for (i = 0; args[i] != NULL; i++) {
+    if (strcmp(args[i], "|") == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void *pipeline_thread(void *arg)
+{
+  struct pipeline_stage *stage = arg;
+  uint64_t t = soshell_trace_begin();
+
+  soshell_in_fd = stage->in_fd;
+  soshell_out = soshell_out_open(stage->out_fd);
+  stage->builtin(stage->argv);
+  soshell_trace_end("builtin", stage->argv[0], t);
+  // Closing our end is what lets the next stage see end of file.
+  soshell_out_close(soshell_out);
+  soshell_out = NULL;
+  if (stage->in_fd != STDIN_FILENO) {
+    close(stage->in_fd);
+  }
+  return NULL;
+}
+
+static void pipeline_exec(struct pipeline_stage *stage)
+{
+  if (stage->in_fd != STDIN_FILENO) {
+    dup2(stage->in_fd, STDIN_FILENO);
+  }
+  if (stage->out_fd != STDOUT_FILENO) {
+    dup2(stage->out_fd, STDOUT_FILENO);
+  }
+  // The pipe fds are close-on-exec, so the child keeps only 0 and 1.
+  soshell_path_exec(stage->path, stage->argv);
+  perror("soshell");
+  exit(127);
+}
+
+/**
+   @brief Run a pipeline and wait for all of its stages.
+   @param args Null terminated list of arguments, stages separated by "|".
+   @return Always returns 1, to continue execution.
+ */
+int soshell_pipeline(char **args)
+{
+  struct pipeline_stage *stages;
+  sigset_t all, old;
+  char **argv;
+  int n = 1, i, j, fds[2], status;
+  uint64_t t, spawn;
+
+  for (i = 0; args[i] != NULL; i++) {
+    n += (strcmp(args[i], "|") == 0);
+  }
+  argv = soshell_arena_alloc((i + 1) * sizeof(char *));
+  memcpy(argv, args, (i + 1) * sizeof(char *));
+  stages = soshell_arena_alloc(n * sizeof(*stages));
+  memset(stages, 0, n * sizeof(*stages));
+
+  stages[0].argv = argv;
+  for (i = 0, j = 1; argv[i] != NULL; i++) {
+    if (strcmp(argv[i], "|") == 0) {
+      argv[i] = NULL;
+      stages[j++].argv = &argv[i + 1];
+    }
+  }
+  for (j = 0; j < n; j++) {
+    if (stages[j].argv[0] == NULL) {
+      fprintf(stderr, "soshell: syntax error near \"|\"\n");
+      return 1;
+    }
+    stages[j].builtin = soshell_find_builtin(stages[j].argv[0]);
+    if (stages[j].builtin != NULL && soshell_builtin_changes_shell(stages[j].argv[0])) {
+      // On a stage thread it would change the shell behind its back.
+      fprintf(stderr, "soshell: %s: cannot run in a pipeline\n", stages[j].argv[0]);
+      return 1;
+    }
+    if (stages[j].builtin == NULL) {
+      stages[j].path = soshell_arena_alloc(PATH_MAX);
+      if (soshell_path_lookup(stages[j].argv[0], stages[j].path, PATH_MAX) != 0) {
+        stages[j].path = NULL;
+      }
+    }
+  }
+
+  stages[0].in_fd = STDIN_FILENO;
+  stages[n - 1].out_fd = STDOUT_FILENO;
+  for (j = 0; j < n - 1; j++) {
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+      perror("soshell");
+      for (i = 0; i < j; i++) {
+        close(stages[i].out_fd);
+        close(stages[i + 1].in_fd);
+      }
+      return 1;
+    }
+    stages[j].out_fd = fds[1];
+    stages[j + 1].in_fd = fds[0];
+  }
+
+  // Fork every external stage before any thread exists.
+  soshell_out_flush();
+  for (j = 0; j < n; j++) {
+    if (stages[j].builtin != NULL) {
+      continue;
+    }
+    t = soshell_trace_begin();
+    spawn = soshell_stats_spawn_begin();
+    stages[j].pid = fork();
+    if (stages[j].pid == 0) {
+      pipeline_exec(&stages[j]);
+    } else if (stages[j].pid < 0) {
+      perror("soshell");
+    } else {
+      soshell_stats_spawn_end(spawn);
+      soshell_counters.forks++;
+    }
+    soshell_trace_end("fork", stages[j].argv[0], t);
+  }
+  for (j = 0; j < n; j++) {
+    if (stages[j].builtin == NULL) {
+      if (stages[j].in_fd != STDIN_FILENO) {
+        close(stages[j].in_fd);
+      }
+      if (stages[j].out_fd != STDOUT_FILENO) {
+        close(stages[j].out_fd);
+      }
+    }
+  }
+
+  /*
+    Stage threads block every signal: interactive signals belong to the
+    shell, and a write to a closed pipe must fail with EPIPE on the
+    stage rather than kill the shell with SIGPIPE.
+   */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  for (j = 0; j < n - 1; j++) {
+    if (stages[j].builtin == NULL) {
+      continue;
+    }
+    if (pthread_create(&stages[j].thread, NULL, pipeline_thread, &stages[j]) == 0) {
+      stages[j].threaded = 1;
+    } else {
+      fprintf(stderr, "soshell: could not start pipeline stage\n");
+      close(stages[j].out_fd);
+      if (stages[j].in_fd != STDIN_FILENO) {
+        close(stages[j].in_fd);
+      }
+    }
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  if (stages[n - 1].builtin != NULL) {
+    t = soshell_trace_begin();
+    soshell_in_fd = stages[n - 1].in_fd;
+    stages[n - 1].builtin(stages[n - 1].argv);
+    soshell_out_flush();
+    soshell_trace_end("builtin", stages[n - 1].argv[0], t);
+    if (soshell_in_fd != STDIN_FILENO) {
+      close(soshell_in_fd);
+    }
+    soshell_in_fd = STDIN_FILENO;
+  }
+
+  t = soshell_trace_begin();
+  for (j = 0; j < n; j++) {
+    if (stages[j].threaded) {
+      pthread_join(stages[j].thread, NULL);
+    } else if (stages[j].builtin == NULL && stages[j].pid > 0) {
+      do {
+        waitpid(stages[j].pid, &status, WUNTRACED);
+      } while (!WIFEXITED(status) && !WIFSIGNALED(status));
+      if (j == n - 1) {
+        soshell_record_status(status);
+      }
+      if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+        soshell_counters.exec_failures++;
+      }
+    }
+  }
+  soshell_trace_end("wait", NULL, t);
+
+  return 1;
+}
@@ -0,0 +1,7 @@
+#ifndef SOSHELL_PIPELINE_H
+#define SOSHELL_PIPELINE_H
+
+int soshell_is_pipeline(char **args);
+int soshell_pipeline(char **args);
+
+#endif
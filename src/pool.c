@@ -0,0 +1,298 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "pool.h"
+
+/*
+  Every worker owns a deque of tasks.  A task submitted by a worker
+  goes on its own deque and the worker takes its newest task first, so
+  a tree walk proceeds depth first with a bounded queue.  A worker with
+  nothing left steals the oldest task of another, which near the root
+  of a walk is the biggest piece of work.  Tasks submitted from outside
+  the pool are spread round robin.  Each deque has its own lock; the
+  pool lock is only taken to sleep and wake.
+ */
+
+#define POOL_MAX_THREADS 64
+#define POOL_DEQUE_INIT 64
+
+struct pool_task {
+  void (*fn)(void *);
+  void *arg;
+};
+
+struct pool_deque {
+  pthread_mutex_t lock;
+  struct pool_task *tasks; /* ring of cap entries, cap a power of two */
+  size_t cap;
+  size_t head;             /* oldest task, taken by thieves */
+  size_t tail;             /* one past the newest, taken by the owner */
+  struct soshell_pool *pool;
+  int index;
+} __attribute__((aligned(64)));
+
+struct soshell_pool {
+  pthread_mutex_t lock;
+  pthread_cond_t work;     /* signalled when a task is queued or on shutdown */
+  pthread_cond_t idle;     /* signalled when pending drops to zero */
+  atomic_long queued;      /* tasks sitting in deques */
+  atomic_long pending;     /* queued plus running tasks */
+  atomic_int sleeping;     /* workers waiting on work */
+  atomic_uint next;        /* round robin for outside submits */
+  int shutdown;
+  int nthreads;
+  int ndeques;             /* one per worker asked for */
+  struct pool_deque *deques;
+  pthread_t threads[];
+};
+
+/* Pool and deque of the worker running on this thread, if any. */
+static __thread struct soshell_pool *pool_self;
+static __thread int pool_self_index;
+
+static void pool_deque_push(struct pool_deque *dq, void (*fn)(void *), void *arg)
+{
+  struct pool_task *tasks;
+  size_t i;
+
+  pthread_mutex_lock(&dq->lock);
+  if (dq->tail - dq->head == dq->cap) {
+    tasks = malloc(2 * dq->cap * sizeof(*tasks));
+    if (!tasks) {
+      fprintf(stderr, "soshell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+    for (i = dq->head; i != dq->tail; i++) {
+      tasks[i & (2 * dq->cap - 1)] = dq->tasks[i & (dq->cap - 1)];
+    }
+    free(dq->tasks);
+    dq->tasks = tasks;
+    dq->cap *= 2;
+  }
+  dq->tasks[dq->tail & (dq->cap - 1)].fn = fn;
+  dq->tasks[dq->tail & (dq->cap - 1)].arg = arg;
+  dq->tail++;
+  pthread_mutex_unlock(&dq->lock);
+}
+
+/*
+  Take the newest task (own == 1) or the oldest (a steal).
+ */
+static int pool_deque_take(struct pool_deque *dq, int own, struct pool_task *task)
+{
+  int found = 0;
+
+  pthread_mutex_lock(&dq->lock);
+  if (dq->tail != dq->head) {
+    if (own) {
+      *task = dq->tasks[--dq->tail & (dq->cap - 1)];
+    } else {
+      *task = dq->tasks[dq->head++ & (dq->cap - 1)];
+    }
+    found = 1;
+  }
+  pthread_mutex_unlock(&dq->lock);
+  return found;
+}
+
+static int pool_take(struct soshell_pool *pool, int self, struct pool_task *task)
+{
+  int i;
+
+  if (pool_deque_take(&pool->deques[self], 1, task)) {
+    return 1;
+  }
+  for (i = 1; i < pool->ndeques; i++) {
+    if (pool_deque_take(&pool->deques[(self + i) % pool->ndeques], 0, task)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void *pool_worker(void *arg)
+{
+  struct pool_deque *dq = arg;
+  struct soshell_pool *pool = dq->pool;
+  struct pool_task task;
+
+  pool_self = pool;
+  pool_self_index = dq->index;
+  for (;;) {
+    if (pool_take(pool, dq->index, &task)) {
+      atomic_fetch_sub(&pool->queued, 1);
+      task.fn(task.arg);
+      if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->idle);
+        pthread_mutex_unlock(&pool->lock);
+      }
+      continue;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    atomic_fetch_add(&pool->sleeping, 1);
+    while (atomic_load(&pool->queued) <= 0 && !pool->shutdown) {
+      pthread_cond_wait(&pool->work, &pool->lock);
+    }
+    atomic_fetch_sub(&pool->sleeping, 1);
+    if (pool->shutdown && atomic_load(&pool->queued) <= 0) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+  return NULL;
+}
+
+/**
+   @brief Number of CPUs available to the shell.
+   @return At least 1.
+ */
+int soshell_ncpus(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return n < 1 ? 1 : (int)n;
+}
+
+/**
+   @brief Start a pool of worker threads.
+   @param nthreads Number of workers; 0 means one per CPU.
+   @return The pool.
+ */
+struct soshell_pool *soshell_pool_create(int nthreads)
+{
+  struct soshell_pool *pool;
+  sigset_t all, old;
+  int i;
+
+  if (nthreads <= 0) {
+    nthreads = soshell_ncpus();
+  }
+  if (nthreads > POOL_MAX_THREADS) {
+    nthreads = POOL_MAX_THREADS;
+  }
+  pool = calloc(1, sizeof(*pool) + nthreads * sizeof(pthread_t));
+  if (pool) {
+    pool->deques = aligned_alloc(64, nthreads * sizeof(*pool->deques));
+  }
+  if (!pool || !pool->deques) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  pthread_cond_init(&pool->idle, NULL);
+  pool->ndeques = nthreads;
+  for (i = 0; i < nthreads; i++) {
+    pthread_mutex_init(&pool->deques[i].lock, NULL);
+    pool->deques[i].tasks = malloc(POOL_DEQUE_INIT * sizeof(struct pool_task));
+    if (!pool->deques[i].tasks) {
+      fprintf(stderr, "soshell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+    pool->deques[i].cap = POOL_DEQUE_INIT;
+    pool->deques[i].head = pool->deques[i].tail = 0;
+    pool->deques[i].pool = pool;
+    pool->deques[i].index = i;
+  }
+
+  // Signals are for the shell's main thread, as with pipeline stages.
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  for (i = 0; i < nthreads; i++) {
+    if (pthread_create(&pool->threads[i], NULL, pool_worker, &pool->deques[i]) != 0) {
+      break;
+    }
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  pool->nthreads = i;
+  if (i == 0) {
+    fprintf(stderr, "soshell: could not start worker threads\n");
+  }
+  return pool;
+}
+
+/**
+   @brief Number of workers actually running in a pool.
+   @param pool The pool.
+   @return Number of threads, 0 if none could be started.
+ */
+int soshell_pool_nthreads(struct soshell_pool *pool)
+{
+  return pool->nthreads;
+}
+
+/**
+   @brief Queue a task.  Runs it at once if the pool has no workers.
+   @param pool The pool.
+   @param fn Task function.
+   @param arg Argument for fn.
+ */
+void soshell_pool_submit(struct soshell_pool *pool, void (*fn)(void *), void *arg)
+{
+  int index;
+
+  if (pool->nthreads == 0) {
+    fn(arg);
+    return;
+  }
+  if (pool_self == pool) {
+    index = pool_self_index;
+  } else {
+    index = atomic_fetch_add(&pool->next, 1) % pool->nthreads;
+  }
+  atomic_fetch_add(&pool->pending, 1);
+  pool_deque_push(&pool->deques[index], fn, arg);
+  atomic_fetch_add(&pool->queued, 1);
+  if (atomic_load(&pool->sleeping) > 0) {
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+/**
+   @brief Wait until every submitted task has finished.
+   @param pool The pool.
+ */
+void soshell_pool_wait(struct soshell_pool *pool)
+{
+  pthread_mutex_lock(&pool->lock);
+  while (atomic_load(&pool->pending) > 0) {
+    pthread_cond_wait(&pool->idle, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+   @brief Wait for all tasks, then stop the workers and free the pool.
+   @param pool The pool.
+ */
+void soshell_pool_destroy(struct soshell_pool *pool)
+{
+  int i;
+
+  soshell_pool_wait(pool);
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+  for (i = 0; i < pool->nthreads; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  for (i = 0; i < pool->ndeques; i++) {
+    pthread_mutex_destroy(&pool->deques[i].lock);
+    free(pool->deques[i].tasks);
+  }
+  free(pool->deques);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->work);
+  pthread_cond_destroy(&pool->idle);
+  free(pool);
+}
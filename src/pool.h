@@ -0,0 +1,18 @@
+#ifndef SOSHELL_POOL_H
+#define SOSHELL_POOL_H
+
+/*
+  Fixed-size pool of worker threads for builtins that split work up.
+  Tasks may submit further tasks; soshell_pool_wait() returns once all
+  of them, including those, have finished.
+ */
+struct soshell_pool;
+
+struct soshell_pool *soshell_pool_create(int nthreads);
+void soshell_pool_submit(struct soshell_pool *pool, void (*fn)(void *), void *arg);
+void soshell_pool_wait(struct soshell_pool *pool);
+void soshell_pool_destroy(struct soshell_pool *pool);
+int soshell_pool_nthreads(struct soshell_pool *pool);
+int soshell_ncpus(void);
+
+#endif
@@ -0,0 +1,300 @@
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "alias.h"
+#include "rc.h"
+#include "shell.h"
+#include "var.h"
+
+/*
+  The startup file is run line by line like a script, but its results
+  are also kept in a snapshot, <rc>.snap, written after the first load.
+  When the startup file has not changed since (same inode, size and
+  modification time), the snapshot is mapped and replayed instead, with
+  no reading, splitting or expanding of lines.
+
+  The snapshot is a header followed by records, in the order of the
+  lines they come from.  A line of plain NAME=value words is stored as
+  one RC_VAR record per variable, applied directly on replay, and an
+  alias definition as an RC_ALIAS record, already split into words.
+  Any other line may depend on the shell's state when it runs
+  (arithmetic, globbing, the current directory), so it is stored as an
+  RC_LINE record and run again as it is.  Blank lines and # comments
+  are left out.
+ */
+
+#define RC_MAGIC "soshsnp"
+#define RC_VERSION 2
+
+enum rc_type {
+  RC_VAR = 1,              /* name, value */
+  RC_LINE,                 /* command line */
+  RC_ALIAS                 /* name, value and its words */
+};
+
+struct rc_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t size;           /* of the whole snapshot */
+  uint64_t dev;            /* identity of the startup file */
+  uint64_t ino;
+  int64_t rc_size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+};
+
+struct rc_record {
+  uint32_t type;
+  uint32_t len;            /* bytes of NUL terminated strings that follow */
+};
+
+struct rc_buf {
+  char *data;
+  size_t len;
+  size_t cap;
+};
+
+static void rc_append(struct rc_buf *b, const void *p, size_t len)
+{
+  while (b->len + len > b->cap) {
+    b->cap = b->cap ? b->cap * 2 : 4096;
+    b->data = realloc(b->data, b->cap);
+    if (!b->data) {
+      fprintf(stderr, "soshell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memcpy(b->data + b->len, p, len);
+  b->len += len;
+}
+
+/*
+  Add a record, padded so the next record is aligned.
+ */
+static void rc_record(struct rc_buf *b, enum rc_type type, const char *data, size_t len)
+{
+  static const char zeros[8];
+  struct rc_record rec;
+
+  rec.type = type;
+  rec.len = len;
+  rc_append(b, &rec, sizeof(rec));
+  rc_append(b, data, len);
+  rc_append(b, zeros, -len & 7);
+}
+
+static void rc_record_alias(const struct soshell_alias *a, void *arg)
+{
+  rc_record(arg, RC_ALIAS, a->name, a->len);
+}
+
+/*
+  Whether a line is only NAME=value words, with nothing to expand.
+ */
+static int rc_is_declarative(const char *line)
+{
+  char *copy, *word, *save;
+  int ok = 1;
+
+  if (strstr(line, "$(") != NULL || (copy = strdup(line)) == NULL) {
+    return 0;
+  }
+  for (word = strtok_r(copy, " \t\r\n\a", &save); word != NULL && ok;
+       word = strtok_r(NULL, " \t\r\n\a", &save)) {
+    ok = soshell_var_is_assignment(word);
+  }
+  free(copy);
+  return ok;
+}
+
+/*
+  Run one line of the startup file and record it.  Returns the shell's
+  status: 0 if the line was exit.
+ */
+static int rc_run_line(struct rc_buf *b, char *line)
+{
+  char *word, *save, *eq;
+  unsigned long gen;
+  int status;
+
+  word = line + strspn(line, " \t");
+  if (*word == '\0' || *word == '#') {
+    free(line);
+    return 1;
+  }
+  // Definitions are stored already split into words.
+  if (strncmp(word, "alias", 5) == 0 && strchr(" \t", word[5]) != NULL &&
+      strchr(word, '=') != NULL && strstr(word, "$(") == NULL) {
+    gen = soshell_alias_generation();
+    status = soshell_run_line(line);
+    soshell_alias_each_since(gen, rc_record_alias, b);
+    return status;
+  }
+  if (!rc_is_declarative(line)) {
+    rc_record(b, RC_LINE, line, strlen(line) + 1);
+    return soshell_run_line(line);
+  }
+  for (word = strtok_r(line, " \t\r\n\a", &save); word != NULL;
+       word = strtok_r(NULL, " \t\r\n\a", &save)) {
+    eq = strchr(word, '=');
+    *eq = '\0';
+    soshell_var_set(soshell_var_lookup(word, eq - word, 1), eq + 1);
+    rc_record(b, RC_VAR, word, eq - word + strlen(eq + 1) + 2);
+  }
+  free(line);
+  return 1;
+}
+
+/*
+  Write the snapshot next to the startup file, atomically.  A failure
+  only means the next startup reads the file again.
+ */
+static void rc_save(const char *snap, struct rc_buf *b)
+{
+  char tmp[4096];
+  int fd;
+
+  ((struct rc_header *)b->data)->size = b->len;
+  if (snprintf(tmp, sizeof(tmp), "%s.%d", snap, (int)getpid()) >= (int)sizeof(tmp)) {
+    return;
+  }
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    return;
+  }
+  if (write(fd, b->data, b->len) != (ssize_t)b->len || close(fd) != 0 ||
+      rename(tmp, snap) != 0) {
+    unlink(tmp);
+  }
+}
+
+/*
+  Replay a snapshot.  Returns the shell's status, or -1 if the snapshot
+  does not belong to this startup file and it must be read instead.
+ */
+static int rc_replay(const char *snap, const struct rc_header *want)
+{
+  const struct rc_header *h;
+  const struct rc_record *rec;
+  const char *p, *end, *s;
+  char *line;
+  struct stat st;
+  void *map;
+  int fd, status = 1;
+
+  fd = open(snap, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(*h)) {
+    close(fd);
+    return -1;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+  h = map;
+  if (memcmp(h, want, offsetof(struct rc_header, size)) != 0 || h->size != st.st_size ||
+      memcmp(&h->dev, &want->dev, sizeof(*h) - offsetof(struct rc_header, dev)) != 0) {
+    munmap(map, st.st_size);
+    return -1;
+  }
+
+  p = (const char *)map + sizeof(*h);
+  end = (const char *)map + st.st_size;
+  while (status && p + sizeof(*rec) <= end) {
+    rec = (const struct rc_record *)p;
+    s = p + sizeof(*rec);
+    p = s + ((rec->len + 7) & ~(size_t)7);
+    if (rec->len == 0 || p > end || s[rec->len - 1] != '\0') {
+      break;
+    }
+    if (rec->type == RC_VAR) {
+      soshell_var_set(soshell_var_lookup(s, strlen(s), 1), s + strlen(s) + 1);
+    } else if (rec->type == RC_LINE) {
+      line = strdup(s);
+      if (!line) {
+        fprintf(stderr, "soshell: allocation error\n");
+        exit(EXIT_FAILURE);
+      }
+      status = soshell_run_line(line);
+    } else if (rec->type == RC_ALIAS) {
+      soshell_alias_load(s, rec->len);
+    }
+  }
+  munmap(map, st.st_size);
+  return status;
+}
+
+/**
+   @brief Run the startup file, from its snapshot if it is up to date.
+   @return 1 if the shell should continue running, 0 if the startup
+   file ran exit.
+ */
+int soshell_rc_load(void)
+{
+  const char *rc = getenv("SOSHELL_RC"), *home;
+  char path[4096], snap[4096];
+  struct rc_header header;
+  struct rc_buf b = { NULL, 0, 0 };
+  struct stat st;
+  FILE *f;
+  char *line;
+  int status = 1;
+
+  if (rc == NULL) {
+    home = getenv("HOME");
+    if (home == NULL || home[0] == '\0') {
+      return 1;
+    }
+    snprintf(path, sizeof(path), "%s/.soshellrc", home);
+    rc = path;
+  }
+  if (rc[0] == '\0' || (f = fopen(rc, "re")) == NULL) {
+    return 1;
+  }
+  if (fstat(fileno(f), &st) != 0) {
+    fclose(f);
+    return 1;
+  }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, RC_MAGIC, sizeof(header.magic));
+  header.version = RC_VERSION;
+  header.dev = st.st_dev;
+  header.ino = st.st_ino;
+  header.rc_size = st.st_size;
+  header.mtime_sec = st.st_mtim.tv_sec;
+  header.mtime_nsec = st.st_mtim.tv_nsec;
+  // A path too long for the snapshot's name only goes without one.
+  if (snprintf(snap, sizeof(snap), "%s.snap", rc) >= (int)sizeof(snap)) {
+    snap[0] = '\0';
+  }
+
+  status = snap[0] ? rc_replay(snap, &header) : -1;
+  if (status >= 0) {
+    fclose(f);
+    return status;
+  }
+  status = 1;
+  rc_append(&b, &header, sizeof(header));
+  while (status && (line = soshell_read_line(f)) != NULL) {
+    status = rc_run_line(&b, line);
+  }
+  fclose(f);
+  if (snap[0] != '\0') {
+    rc_save(snap, &b);
+  }
+  free(b.data);
+  return status;
+}
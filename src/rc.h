@@ -0,0 +1,9 @@
+#ifndef SOSHELL_RC_H
+#define SOSHELL_RC_H
+
+/*
+  Startup file: ~/.soshellrc, or $SOSHELL_RC (empty for none).
+ */
+int soshell_rc_load(void);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef SOSHELL_SHELL_H
+#define SOSHELL_SHELL_H
+
+#include <stdio.h>
+
+/*
+  The shell's read-expand-execute steps, for main() and for programs
+  built with -DSOSHELL_NO_MAIN that drive them directly (bench/).
+ */
+char *soshell_read_line(FILE *in);
+char **soshell_split_line(char *line);
+int soshell_launch(char **args);
+int soshell_run_line(char *line);
+int soshell_run_string(const char *script);
+void soshell_loop(FILE *in);
+int soshell_run_args(int argc, char **argv);
+
+/*
+  Exit status of the last command, which soshell_run_args() returns:
+  what the command exited with, or what the builtin set (0 unless it
+  says otherwise, as grep does).  Per thread, so pipeline stages on
+  threads of their own leave it alone.
+ */
+extern __thread int soshell_last_status;
+void soshell_record_status(int wstatus);
+
+#endif
@@ -0,0 +1,818 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "sort.h"
+#include "io.h"
+#include "job.h"
+#include "pool.h"
+
+/*
+  sort [-r] [-u] [-S size] [file...]
+
+  Lines compare as bytes, like sort in the C locale.  Input is cut into
+  chunks that fit the memory budget; regular files are mmap'd and a
+  chunk is then only an array of views into the mapping.  A chunk is
+  split in one part per worker, parts are sorted in parallel with a
+  multikey quicksort and merged with a loser tree.  When more input
+  follows, the merged chunk is written to an unlinked temporary file as
+  a sorted run; at the end the runs and the last chunk, still in
+  memory, are merged into the output with the same loser tree.
+
+  Each run open for merging costs a descriptor and a read buffer, so no
+  merge takes more than fanin runs.  Runs are merged in passes as they
+  are made: fanin runs of one level become a run of the next level, so
+  every line is written about log_fanin(runs) times and the runs open
+  at once stay few.
+ */
+
+#define SORT_DEFAULT_MEMORY (256L * 1024 * 1024)
+#define SORT_PARALLEL_MIN 65536  /* lines below which one part is enough */
+#define SORT_INSERTION 16
+#define SORT_WRITE_BUFSIZE (1024 * 1024)
+#define SORT_READ_BUFSIZE (256 * 1024)
+#define SORT_MIN_READ_BUFSIZE (4 * 1024)
+#define SORT_MERGE_FANIN 16
+
+struct sort_line {
+  const unsigned char *s;
+  size_t len;
+};
+
+/* A sorted run in a temporary file, read back one line at a time. */
+struct sort_reader {
+  int fd;
+  unsigned char *buf;
+  size_t cap;
+  size_t start;
+  size_t end;
+  int eof;
+  int level;               /* merge passes its lines went through */
+};
+
+/* One input of a merge: part of a chunk in memory, or a run. */
+struct sort_source {
+  const unsigned char *s;  /* current line */
+  size_t len;
+  int done;
+  struct sort_line *lines; /* in-memory part, or NULL */
+  size_t pos;
+  size_t n;
+  int step;                /* 1, or -1 to read the part backwards for -r */
+  struct sort_reader *reader;
+};
+
+/* Where merged lines go: a run file, or the builtin's output. */
+struct sort_sink {
+  int fd;                  /* -1 for the builtin output */
+  int unique;
+  int error;
+  unsigned char *buf;
+  size_t len;
+  unsigned char *last;     /* last line emitted, for -u */
+  size_t lastlen;
+  size_t lastcap;
+  int has_last;
+};
+
+struct sort_part {
+  struct sort_line *lines;
+  size_t n;
+};
+
+struct sort_ctx {
+  int reverse;
+  int unique;
+  long memory;
+  struct soshell_pool *pool;
+  struct sort_reader *runs;
+  int nruns;
+  int fanin;               /* most runs read by one merge */
+  int maxruns;             /* most runs kept open, from RLIMIT_NOFILE */
+  size_t readbuf;          /* read buffer of a run */
+  int error;
+};
+
+static int sort_cmp(const struct sort_line *a, const struct sort_line *b)
+{
+  size_t n = a->len < b->len ? a->len : b->len;
+  int c = memcmp(a->s, b->s, n);
+
+  if (c != 0) {
+    return c;
+  }
+  return (a->len > b->len) - (a->len < b->len);
+}
+
+static int sort_char(const struct sort_line *l, size_t d)
+{
+  return d < l->len ? l->s[d] : -1;
+}
+
+static void sort_swap(struct sort_line *a, struct sort_line *b)
+{
+  struct sort_line t = *a;
+
+  *a = *b;
+  *b = t;
+}
+
+/*
+  Insertion sort of lines known to agree on their first d bytes.
+ */
+static void sort_insertion(struct sort_line *a, size_t n, size_t d)
+{
+  struct sort_line key, tail, t;
+  size_t i, j;
+
+  for (i = 1; i < n; i++) {
+    key = a[i];
+    tail.s = key.s + d;
+    tail.len = key.len - d;
+    for (j = i; j > 0; j--) {
+      t.s = a[j - 1].s + d;
+      t.len = a[j - 1].len - d;
+      if (sort_cmp(&t, &tail) <= 0) {
+        break;
+      }
+      a[j] = a[j - 1];
+    }
+    a[j] = key;
+  }
+}
+
+/*
+  Multikey quicksort (Bentley and Sedgewick): a three-way partition on
+  the byte at depth d, so bytes already known equal are never compared
+  again.
+ */
+static void sort_mkqs(struct sort_line *a, size_t n, size_t d)
+{
+  struct {
+    struct sort_line *a;
+    size_t n;
+    size_t d;
+  } part[3];
+  size_t lt, gt, i;
+  int v, c, x, y, z, j, big;
+
+  while (n > SORT_INSERTION) {
+    x = sort_char(&a[0], d);
+    y = sort_char(&a[n / 2], d);
+    z = sort_char(&a[n - 1], d);
+    v = (x < y) ? ((y < z) ? y : (x < z) ? z : x) : ((x < z) ? x : (y < z) ? z : y);
+
+    lt = 0;
+    i = 0;
+    gt = n;
+    while (i < gt) {
+      c = sort_char(&a[i], d);
+      if (c < v) {
+        sort_swap(&a[lt++], &a[i++]);
+      } else if (c > v) {
+        sort_swap(&a[i], &a[--gt]);
+      } else {
+        i++;
+      }
+    }
+    part[0].a = a;
+    part[0].n = lt;
+    part[0].d = d;
+    // Every line in the middle that ended here is equal: nothing to do.
+    part[1].a = a + lt;
+    part[1].n = (v < 0) ? 0 : gt - lt;
+    part[1].d = d + 1;
+    part[2].a = a + gt;
+    part[2].n = n - gt;
+    part[2].d = d;
+    /*
+      Recurse into the two smaller parts, which are at most half of n,
+      and go on with the largest here: the stack stays O(log n) deep.
+     */
+    big = (part[0].n >= part[1].n) ? 0 : 1;
+    big = (part[big].n >= part[2].n) ? big : 2;
+    for (j = 0; j < 3; j++) {
+      if (j != big && part[j].n > 1) {
+        sort_mkqs(part[j].a, part[j].n, part[j].d);
+      }
+    }
+    a = part[big].a;
+    n = part[big].n;
+    d = part[big].d;
+  }
+  sort_insertion(a, n, d);
+}
+
+static void sort_part_run(void *arg)
+{
+  struct sort_part *part = arg;
+
+  sort_mkqs(part->lines, part->n, 0);
+}
+
+static void *sort_alloc(size_t n)
+{
+  void *p = malloc(n);
+
+  if (!p) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static void sort_write_all(struct sort_sink *sink, const unsigned char *p, size_t n)
+{
+  ssize_t w;
+
+  while (n > 0 && !sink->error) {
+    w = write(sink->fd, p, n);
+    if (w < 0 && errno == EINTR) {
+      continue;
+    }
+    if (w < 0) {
+      fprintf(stderr, "soshell: sort: temporary file: %s\n", strerror(errno));
+      sink->error = 1;
+      return;
+    }
+    p += w;
+    n -= w;
+  }
+}
+
+static void sort_emit(struct sort_sink *sink, const unsigned char *s, size_t len)
+{
+  if (sink->unique) {
+    if (sink->has_last && sink->lastlen == len && memcmp(sink->last, s, len) == 0) {
+      return;
+    }
+    if (len > sink->lastcap) {
+      sink->lastcap = 2 * len;
+      free(sink->last);
+      sink->last = sort_alloc(sink->lastcap);
+    }
+    memcpy(sink->last, s, len);
+    sink->lastlen = len;
+    sink->has_last = 1;
+  }
+  if (sink->fd < 0) {
+    soshell_out_write((const char *)s, len);
+    soshell_out_write("\n", 1);
+    return;
+  }
+  if (sink->len + len + 1 > SORT_WRITE_BUFSIZE) {
+    sort_write_all(sink, sink->buf, sink->len);
+    sink->len = 0;
+    if (len + 1 > SORT_WRITE_BUFSIZE) {
+      sort_write_all(sink, s, len);
+      sort_write_all(sink, (const unsigned char *)"\n", 1);
+      return;
+    }
+  }
+  memcpy(sink->buf + sink->len, s, len);
+  sink->buf[sink->len + len] = '\n';
+  sink->len += len + 1;
+}
+
+/*
+  Next line of a run.  The line stays valid until the next call.
+ */
+static int sort_reader_next(struct sort_reader *r, const unsigned char **s, size_t *len)
+{
+  unsigned char *nl;
+  ssize_t n;
+
+  for (;;) {
+    nl = memchr(r->buf + r->start, '\n', r->end - r->start);
+    if (nl != NULL) {
+      *s = r->buf + r->start;
+      *len = nl - *s;
+      r->start = nl + 1 - r->buf;
+      return 1;
+    }
+    if (r->eof) {
+      // Runs always end in a newline.
+      return 0;
+    }
+    memmove(r->buf, r->buf + r->start, r->end - r->start);
+    r->end -= r->start;
+    r->start = 0;
+    if (r->end == r->cap) {
+      r->cap *= 2;
+      r->buf = realloc(r->buf, r->cap);
+      if (!r->buf) {
+        fprintf(stderr, "soshell: allocation error\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    n = read(r->fd, r->buf + r->end, r->cap - r->end);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      fprintf(stderr, "soshell: sort: temporary file: %s\n", strerror(errno));
+    }
+    if (n <= 0) {
+      r->eof = 1;
+    } else {
+      r->end += n;
+    }
+    soshell_job_yield();
+  }
+}
+
+static void sort_source_next(struct sort_source *src)
+{
+  if (src->reader) {
+    src->done = !sort_reader_next(src->reader, &src->s, &src->len);
+    return;
+  }
+  if (src->pos == src->n) {
+    src->done = 1;
+    return;
+  }
+  if (src->step > 0) {
+    src->s = src->lines[src->pos].s;
+    src->len = src->lines[src->pos].len;
+  } else {
+    src->s = src->lines[src->n - 1 - src->pos].s;
+    src->len = src->lines[src->n - 1 - src->pos].len;
+  }
+  src->pos++;
+}
+
+/*
+  Whether source a comes out before source b.  Index k stands for a
+  virtual source that beats everything, used to build the tree.
+ */
+static int sort_beats(struct sort_source *src, int k, int reverse, int a, int b)
+{
+  struct sort_line la, lb;
+  int c;
+
+  if (a == k || b == k) {
+    return a == k;
+  }
+  if (src[a].done || src[b].done) {
+    return src[b].done && !src[a].done;
+  }
+  la.s = src[a].s;
+  la.len = src[a].len;
+  lb.s = src[b].s;
+  lb.len = src[b].len;
+  c = sort_cmp(&la, &lb);
+  if (reverse) {
+    c = -c;
+  }
+  return c < 0 || (c == 0 && a < b);
+}
+
+static void sort_adjust(struct sort_source *src, int *tree, int k, int reverse, int s)
+{
+  int t, tmp;
+
+  for (t = (s + k) / 2; t > 0; t /= 2) {
+    if (sort_beats(src, k, reverse, tree[t], s)) {
+      tmp = s;
+      s = tree[t];
+      tree[t] = tmp;
+    }
+  }
+  tree[0] = s;
+}
+
+/*
+  k-way merge with a loser tree: each internal node keeps the loser of
+  the match played there, so replacing the winner costs one path of
+  log2(k) comparisons back to the root.
+ */
+static void sort_merge(struct sort_source *src, int k, int reverse, struct sort_sink *sink)
+{
+  int *tree = sort_alloc(k * sizeof(int));
+  int i, w;
+
+  for (i = 0; i < k; i++) {
+    sort_source_next(&src[i]);
+    tree[i] = k;
+  }
+  for (i = k - 1; i >= 0; i--) {
+    sort_adjust(src, tree, k, reverse, i);
+  }
+  for (;;) {
+    w = tree[0];
+    if (src[w].done) {
+      break;
+    }
+    sort_emit(sink, src[w].s, src[w].len);
+    sort_source_next(&src[w]);
+    sort_adjust(src, tree, k, reverse, w);
+  }
+  free(tree);
+}
+
+/*
+  Split [p, end) into lines.  A last line without a newline counts.
+ */
+static struct sort_line *sort_split(const unsigned char *p, const unsigned char *end, size_t *nlines)
+{
+  size_t n = 0, cap = 1024;
+  struct sort_line *lines = sort_alloc(cap * sizeof(*lines));
+  const unsigned char *nl;
+
+  while (p < end) {
+    nl = memchr(p, '\n', end - p);
+    if (nl == NULL) {
+      nl = end;
+    }
+    if (n == cap) {
+      cap *= 2;
+      lines = realloc(lines, cap * sizeof(*lines));
+      if (!lines) {
+        fprintf(stderr, "soshell: allocation error\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    lines[n].s = p;
+    lines[n++].len = nl - p;
+    p = nl + 1;
+  }
+  *nlines = n;
+  return lines;
+}
+
+static int sort_tmpfile(void)
+{
+  const char *dir = getenv("TMPDIR");
+  char path[4096];
+  int fd;
+
+  snprintf(path, sizeof(path), "%s/soshell-sortXXXXXX", dir && *dir ? dir : "/tmp");
+  fd = mkostemp(path, O_CLOEXEC);
+  if (fd >= 0) {
+    unlink(path);
+  }
+  return fd;
+}
+
+static void sort_reader_open(struct sort_ctx *ctx, struct sort_reader *r)
+{
+  lseek(r->fd, 0, SEEK_SET);
+  r->cap = ctx->readbuf;
+  r->buf = sort_alloc(r->cap);
+  r->start = r->end = 0;
+  r->eof = 0;
+}
+
+/*
+  Merge the runs from first on into one new run, which takes their
+  place at the end of the list.
+ */
+static void sort_merge_runs(struct sort_ctx *ctx, int first)
+{
+  struct sort_source *src;
+  struct sort_sink sink;
+  int k = ctx->nruns - first, i, level = 0;
+
+  memset(&sink, 0, sizeof(sink));
+  sink.unique = ctx->unique;
+  sink.fd = sort_tmpfile();
+  if (sink.fd < 0) {
+    fprintf(stderr, "soshell: sort: temporary file: %s\n", strerror(errno));
+    ctx->error = 1;
+    return;
+  }
+  src = sort_alloc(k * sizeof(*src));
+  memset(src, 0, k * sizeof(*src));
+  for (i = 0; i < k; i++) {
+    sort_reader_open(ctx, &ctx->runs[first + i]);
+    src[i].reader = &ctx->runs[first + i];
+    if (ctx->runs[first + i].level > level) {
+      level = ctx->runs[first + i].level;
+    }
+  }
+  sink.buf = sort_alloc(SORT_WRITE_BUFSIZE);
+  sort_merge(src, k, ctx->reverse, &sink);
+  sort_write_all(&sink, sink.buf, sink.len);
+  ctx->error |= sink.error;
+  free(sink.buf);
+  free(sink.last);
+  free(src);
+
+  for (i = 0; i < k; i++) {
+    close(ctx->runs[first + i].fd);
+    free(ctx->runs[first + i].buf);
+  }
+  memset(&ctx->runs[first], 0, sizeof(*ctx->runs));
+  ctx->runs[first].fd = sink.fd;
+  ctx->runs[first].level = level + 1;
+  ctx->nruns = first + 1;
+}
+
+/*
+  Sort one chunk.  With more input to come it becomes a run; the last
+  chunk is merged with the runs straight into the output.
+ */
+static void sort_chunk(struct sort_ctx *ctx, const unsigned char *p, const unsigned char *end, int more)
+{
+  struct sort_line *lines;
+  struct sort_part *parts;
+  struct sort_source *src;
+  struct sort_sink sink;
+  size_t n, i;
+  int nparts, k, j;
+
+  lines = sort_split(p, end, &n);
+  nparts = 1;
+  if (n >= SORT_PARALLEL_MIN) {
+    if (ctx->pool == NULL) {
+      ctx->pool = soshell_pool_create(0);
+    }
+    nparts = soshell_pool_nthreads(ctx->pool);
+    if (nparts < 1) {
+      nparts = 1;
+    }
+  }
+  parts = sort_alloc(nparts * sizeof(*parts));
+  for (j = 0; j < nparts; j++) {
+    parts[j].lines = lines + n / nparts * j;
+    parts[j].n = (j == nparts - 1) ? n - n / nparts * j : n / nparts;
+  }
+  if (nparts > 1) {
+    for (j = 0; j < nparts; j++) {
+      soshell_pool_submit(ctx->pool, sort_part_run, &parts[j]);
+    }
+    soshell_pool_wait(ctx->pool);
+  } else {
+    sort_part_run(&parts[0]);
+  }
+
+  // The final merge reads at most fanin runs.
+  while (!more && !ctx->error && ctx->nruns > ctx->fanin) {
+    sort_merge_runs(ctx, ctx->nruns - ctx->fanin);
+  }
+
+  memset(&sink, 0, sizeof(sink));
+  sink.unique = ctx->unique;
+  sink.fd = -1;
+  k = nparts + (more ? 0 : ctx->nruns);
+  src = sort_alloc(k * sizeof(*src));
+  memset(src, 0, k * sizeof(*src));
+  for (j = 0; j < nparts; j++) {
+    src[j].lines = parts[j].lines;
+    src[j].n = parts[j].n;
+    src[j].step = ctx->reverse ? -1 : 1;
+  }
+
+  if (more) {
+    sink.fd = sort_tmpfile();
+    if (sink.fd < 0) {
+      fprintf(stderr, "soshell: sort: temporary file: %s\n", strerror(errno));
+      ctx->error = 1;
+    } else {
+      sink.buf = sort_alloc(SORT_WRITE_BUFSIZE);
+      sort_merge(src, k, ctx->reverse, &sink);
+      sort_write_all(&sink, sink.buf, sink.len);
+      free(sink.buf);
+      ctx->error |= sink.error;
+      ctx->runs = realloc(ctx->runs, (ctx->nruns + 1) * sizeof(*ctx->runs));
+      if (!ctx->runs) {
+        fprintf(stderr, "soshell: allocation error\n");
+        exit(EXIT_FAILURE);
+      }
+      memset(&ctx->runs[ctx->nruns], 0, sizeof(*ctx->runs));
+      ctx->runs[ctx->nruns].fd = sink.fd;
+      ctx->nruns++;
+      // A merge pass once fanin runs share a level, or too many are open.
+      while (!ctx->error && ctx->nruns >= ctx->fanin &&
+             (ctx->runs[ctx->nruns - ctx->fanin].level == ctx->runs[ctx->nruns - 1].level ||
+              ctx->nruns >= ctx->maxruns)) {
+        sort_merge_runs(ctx, ctx->nruns - ctx->fanin);
+      }
+    }
+  } else if (!ctx->error) {
+    for (i = 0; i < (size_t)ctx->nruns; i++) {
+      sort_reader_open(ctx, &ctx->runs[i]);
+      src[nparts + i].reader = &ctx->runs[i];
+    }
+    sort_merge(src, k, ctx->reverse, &sink);
+  }
+  free(sink.last);
+  free(src);
+  free(parts);
+  free(lines);
+}
+
+/*
+  Read a stream in chunks of up to max bytes, cut at line ends.
+ */
+static int sort_stream(struct sort_ctx *ctx, int fd, size_t max, int more_files)
+{
+  size_t cap = max, len = 0, keep;
+  unsigned char *buf = sort_alloc(cap), *cut;
+  ssize_t n;
+  int eof = 0, ret = 0;
+
+  while (!eof) {
+    while (len < cap) {
+      n = read(fd, buf + len, cap - len);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        ret = (int)n;
+        eof = 1;
+        break;
+      }
+      len += n;
+      soshell_job_yield();
+    }
+    if (eof) {
+      sort_chunk(ctx, buf, buf + len, more_files);
+      break;
+    }
+    cut = memrchr(buf, '\n', len);
+    if (cut == NULL) {
+      // One line bigger than the budget: let the buffer grow.
+      cap *= 2;
+      buf = realloc(buf, cap);
+      if (!buf) {
+        fprintf(stderr, "soshell: allocation error\n");
+        exit(EXIT_FAILURE);
+      }
+      continue;
+    }
+    cut++;
+    sort_chunk(ctx, buf, cut, 1);
+    keep = buf + len - cut;
+    memmove(buf, cut, keep);
+    len = keep;
+  }
+  free(buf);
+  return ret;
+}
+
+/*
+  Sort a regular file through a read-only mapping.  The mapping of the
+  last file must live until the final merge, so it is returned.
+ */
+static int sort_mapped(struct sort_ctx *ctx, int fd, size_t size, size_t max,
+                       int more_files, void **map)
+{
+  const unsigned char *p, *end, *cut, *nl;
+
+  *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (*map == MAP_FAILED) {
+    *map = NULL;
+    return -1;
+  }
+  madvise(*map, size, MADV_WILLNEED);
+  p = *map;
+  end = p + size;
+  while (p < end) {
+    cut = (end - p > (ptrdiff_t)max) ? p + max : end;
+    if (cut < end) {
+      nl = memrchr(p, '\n', cut - p);
+      if (nl == NULL) {
+        // One line bigger than the budget.
+        nl = memchr(cut, '\n', end - cut);
+      }
+      cut = nl ? nl + 1 : end;
+    }
+    sort_chunk(ctx, p, cut, cut < end || more_files);
+    p = cut;
+  }
+  return 0;
+}
+
+static long sort_parse_size(const char *s)
+{
+  char *end;
+  long n = strtol(s, &end, 10);
+
+  switch (*end) {
+  case 'k': case 'K': n *= 1024; end++; break;
+  case 'm': case 'M': n *= 1024 * 1024; end++; break;
+  case 'g': case 'G': n *= 1024L * 1024 * 1024; end++; break;
+  }
+  return (end == s || *end != '\0') ? -1 : n;
+}
+
+/**
+   @brief Builtin command: sort lines.
+   @param args List of args.  Options -r (reverse), -u (unique) and
+   -S size (memory budget, with an optional K, M or G suffix), then
+   files; none or "-" means standard input.
+   @return Always returns 1, to continue executing.
+ */
+int soshell_sort(char **args)
+{
+  struct sort_ctx ctx;
+  struct rlimit rl;
+  struct stat st;
+  char *none[] = { "-", NULL };
+  char **files;
+  const char *opt;
+  void *map = NULL, *last_map = NULL;
+  size_t max, last_size = 0;
+  int i, fd, more, ret;
+
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.memory = SORT_DEFAULT_MEMORY;
+  for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+    for (opt = args[i] + 1; *opt; opt++) {
+      if (*opt == 'r') {
+        ctx.reverse = 1;
+      } else if (*opt == 'u') {
+        ctx.unique = 1;
+      } else if (*opt == 'S') {
+        opt = opt[1] ? opt + 1 : args[++i];
+        if (opt == NULL || (ctx.memory = sort_parse_size(opt)) <= 0) {
+          fprintf(stderr, "soshell: sort: bad size for -S\n");
+          return 1;
+        }
+        break;
+      } else {
+        fprintf(stderr, "soshell: sort: unknown option -%c\n", *opt);
+        return 1;
+      }
+    }
+  }
+  files = args[i] ? args + i : none;
+  /*
+    Half of the budget goes to a chunk, whose lines take a view of 16
+    bytes each besides their text, and half to the read buffers of the
+    runs in a merge.  Leave descriptors for the rest of the shell.
+   */
+  max = ctx.memory / 2;
+  ctx.fanin = SORT_MERGE_FANIN;
+  ctx.maxruns = INT_MAX;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+    if (rl.rlim_cur / 4 < (rlim_t)ctx.fanin) {
+      ctx.fanin = (rl.rlim_cur / 4 > 2) ? (int)(rl.rlim_cur / 4) : 2;
+    }
+    if (rl.rlim_cur / 2 < (rlim_t)ctx.maxruns) {
+      ctx.maxruns = (int)(rl.rlim_cur / 2);
+    }
+  }
+  ctx.readbuf = ctx.memory / 2 / ctx.fanin;
+  if (ctx.readbuf > SORT_READ_BUFSIZE) {
+    ctx.readbuf = SORT_READ_BUFSIZE;
+  } else if (ctx.readbuf < SORT_MIN_READ_BUFSIZE) {
+    ctx.readbuf = SORT_MIN_READ_BUFSIZE;
+  }
+
+  for (i = 0; files[i] != NULL && !ctx.error; i++) {
+    more = (files[i + 1] != NULL);
+    if (strcmp(files[i], "-") == 0) {
+      fd = soshell_in_fd;
+    } else {
+      fd = open(files[i], O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+        fprintf(stderr, "soshell: sort: %s: %s\n", files[i], strerror(errno));
+        ctx.error = 1;
+        break;
+      }
+    }
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        sort_mapped(&ctx, fd, st.st_size, max, more, &map) == 0) {
+      ret = 0;
+      if (more) {
+        munmap(map, st.st_size);
+      } else {
+        last_map = map;
+        last_size = st.st_size;
+      }
+    } else {
+      ret = sort_stream(&ctx, fd, max, more);
+    }
+    if (ret != 0) {
+      fprintf(stderr, "soshell: sort: %s: %s\n", files[i], strerror(errno));
+    }
+    if (fd != soshell_in_fd) {
+      close(fd);
+    }
+  }
+
+  if (last_map) {
+    munmap(last_map, last_size);
+  }
+  for (i = 0; i < ctx.nruns; i++) {
+    close(ctx.runs[i].fd);
+    free(ctx.runs[i].buf);
+  }
+  free(ctx.runs);
+  if (ctx.pool) {
+    soshell_pool_destroy(ctx.pool);
+  }
+  return 1;
+}
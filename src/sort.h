@@ -0,0 +1,6 @@
+#ifndef SOSHELL_SORT_H
+#define SOSHELL_SORT_H
+
+int soshell_sort(char **args);
+
+#endif
@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "startup.h"
+
+/*
+  Phases are recorded into a small fixed table while profiling, and the
+  table is printed on stderr once, when the shell is about to read its
+  first command.  Without --startup-profile each hook is one test of a
+  flag.
+ */
+
+#define STARTUP_PHASES 16
+
+struct startup_phase {
+  const char *name;
+  uint64_t ns;
+};
+
+int soshell_startup_profiling;
+
+static struct startup_phase startup_phases[STARTUP_PHASES];
+static int startup_nphases;
+static uint64_t startup_t0;
+
+/**
+   @brief Current time for a phase.
+   @return Nanoseconds on the monotonic clock, or 0 when not profiling.
+ */
+uint64_t soshell_startup_now(void)
+{
+  struct timespec ts;
+
+  if (!soshell_startup_profiling) {
+    return 0;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+   @brief Start profiling: main() calls this first thing.
+ */
+void soshell_startup_begin(void)
+{
+  soshell_startup_profiling = 1;
+  startup_t0 = soshell_startup_now();
+}
+
+/**
+   @brief Record a phase that started at start and ends now.
+   @param name Phase name; must be a string constant.
+   @param start Value from soshell_startup_now().
+ */
+void soshell_startup_phase(const char *name, uint64_t start)
+{
+  if (!soshell_startup_profiling || startup_nphases == STARTUP_PHASES) {
+    return;
+  }
+  startup_phases[startup_nphases].name = name;
+  startup_phases[startup_nphases].ns = soshell_startup_now() - start;
+  startup_nphases++;
+}
+
+/**
+   @brief The shell is about to read its first command: print the
+   profile, once.
+ */
+void soshell_startup_ready(void)
+{
+  struct rusage ru;
+  uint64_t total;
+  int i;
+
+  if (!soshell_startup_profiling) {
+    return;
+  }
+  total = soshell_startup_now() - startup_t0;
+  soshell_startup_profiling = 0;
+  for (i = 0; i < startup_nphases; i++) {
+    fprintf(stderr, "startup: %-12s %8.1f us\n", startup_phases[i].name,
+            startup_phases[i].ns / 1e3);
+  }
+  fprintf(stderr, "startup: %-12s %8.1f us\n", "main to ready", total / 1e3);
+  // Time before main(): exec, dynamic linking and constructors.
+  if (getrusage(RUSAGE_SELF, &ru) == 0) {
+    fprintf(stderr, "startup: %-12s %8.1f us cpu, %ld page faults\n", "process",
+            (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e6 +
+            ru.ru_utime.tv_usec + ru.ru_stime.tv_usec, ru.ru_minflt + ru.ru_majflt);
+  }
+}
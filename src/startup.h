@@ -0,0 +1,19 @@
+#ifndef SOSHELL_STARTUP_H
+#define SOSHELL_STARTUP_H
+
+#include <stdint.h>
+
+/*
+  Startup profile, shown by soshell --startup-profile: the time taken by
+  each phase of initialization up to the first command.  Subsystems
+  initialize themselves on first use; whatever does so before the first
+  command is read counts against the startup budget.
+ */
+extern int soshell_startup_profiling;
+
+void soshell_startup_begin(void);
+uint64_t soshell_startup_now(void);
+void soshell_startup_phase(const char *name, uint64_t start);
+void soshell_startup_ready(void);
+
+#endif
@@ -0,0 +1,159 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "stats.h"
+#include "io.h"
+
+/*
+  stats [-m] [-r]
+
+  Prints the counters gathered since the shell started (or since the
+  last stats -r): commands by kind, forks, exec failures, how long it
+  took to get a child running, input read and arena use.  With -m the
+  output is one "name value" pair per line, in the Prometheus text
+  format, for scripts and scrapers.
+ */
+
+struct soshell_counters soshell_counters;
+
+static uint64_t stats_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/*
+  Values below 16 have a bucket each; above, a power of two is split
+  into eight buckets by the three bits after the leading one.
+ */
+static int stats_bucket(uint64_t v)
+{
+  int e;
+
+  if (v < 16) {
+    return v;
+  }
+  e = 63 - __builtin_clzll(v);
+  return 16 + (e - 4) * 8 + ((v >> (e - 3)) & 7);
+}
+
+/*
+  The middle of a bucket, as the value reported for it.
+ */
+static uint64_t stats_bucket_value(int b)
+{
+  int e;
+
+  if (b < 16) {
+    return b;
+  }
+  e = (b - 16) / 8 + 4;
+  return ((uint64_t)(8 + (b - 16) % 8) << (e - 3)) + ((uint64_t)1 << (e - 4));
+}
+
+static uint64_t stats_percentile(double p)
+{
+  uint64_t rank = (uint64_t)(p * soshell_counters.spawns + 0.5), seen = 0;
+  int b;
+
+  if (rank == 0) {
+    rank = 1;
+  }
+  for (b = 0; b < SOSHELL_STATS_BUCKETS; b++) {
+    seen += soshell_counters.spawn_hist[b];
+    if (seen >= rank) {
+      return stats_bucket_value(b);
+    }
+  }
+  return 0;
+}
+
+/**
+   @brief Start timing a spawn.
+   @return The start time.
+ */
+uint64_t soshell_stats_spawn_begin(void)
+{
+  return stats_now();
+}
+
+/**
+   @brief Record a spawn: from the launch to fork() returning in the
+   parent.
+   @param start Value from soshell_stats_spawn_begin().
+ */
+void soshell_stats_spawn_end(uint64_t start)
+{
+  uint64_t ns = stats_now() - start;
+
+  soshell_counters.spawns++;
+  soshell_counters.spawn_ns += ns;
+  soshell_counters.spawn_hist[stats_bucket(ns)]++;
+}
+
+/**
+   @brief Builtin command: print the shell's counters.
+   @param args List of args.  -m for machine-readable output, -r to
+   reset the counters after printing them.
+   @return Always returns 1, to continue executing.
+ */
+int soshell_stats(char **args)
+{
+  struct soshell_counters *c = &soshell_counters;
+  int i, machine = 0, reset = 0;
+  uint64_t p50, p99;
+
+  for (i = 1; args[i] != NULL; i++) {
+    if (strcmp(args[i], "-m") == 0) {
+      machine = 1;
+    } else if (strcmp(args[i], "-r") == 0) {
+      reset = 1;
+    } else {
+      fprintf(stderr, "soshell: stats: unknown option %s\n", args[i]);
+      return 1;
+    }
+  }
+  p50 = c->spawns ? stats_percentile(0.50) : 0;
+  p99 = c->spawns ? stats_percentile(0.99) : 0;
+
+  if (machine) {
+    soshell_out_printf("soshell_commands_total %" PRIu64 "\n", c->commands);
+    soshell_out_printf("soshell_builtins_total %" PRIu64 "\n", c->builtins);
+    soshell_out_printf("soshell_external_total %" PRIu64 "\n", c->external);
+    soshell_out_printf("soshell_pipelines_total %" PRIu64 "\n", c->pipelines);
+    soshell_out_printf("soshell_assignments_total %" PRIu64 "\n", c->assignments);
+    soshell_out_printf("soshell_forks_total %" PRIu64 "\n", c->forks);
+    soshell_out_printf("soshell_exec_failures_total %" PRIu64 "\n", c->exec_failures);
+    soshell_out_printf("soshell_spawns_total %" PRIu64 "\n", c->spawns);
+    soshell_out_printf("soshell_spawn_seconds_total %.9f\n", c->spawn_ns / 1e9);
+    soshell_out_printf("soshell_spawn_seconds{quantile=\"0.5\"} %.9f\n", p50 / 1e9);
+    soshell_out_printf("soshell_spawn_seconds{quantile=\"0.99\"} %.9f\n", p99 / 1e9);
+    soshell_out_printf("soshell_read_lines_total %" PRIu64 "\n", c->read_lines);
+    soshell_out_printf("soshell_read_bytes_total %" PRIu64 "\n", c->read_bytes);
+    soshell_out_printf("soshell_arena_allocs_total %" PRIu64 "\n", c->arena_allocs);
+    soshell_out_printf("soshell_arena_blocks_total %" PRIu64 "\n", c->arena_blocks);
+    soshell_out_printf("soshell_arena_high_water_bytes %" PRIu64 "\n", c->arena_high);
+  } else {
+    soshell_out_printf("commands       %" PRIu64 " (%" PRIu64 " builtin, %" PRIu64 " external, %"
+                       PRIu64 " pipelines, %" PRIu64 " assignments)\n", c->commands,
+                       c->builtins, c->external, c->pipelines, c->assignments);
+    soshell_out_printf("forks          %" PRIu64 ", %" PRIu64 " exec failures\n",
+                       c->forks, c->exec_failures);
+    soshell_out_printf("spawn latency  %.3f ms total, p50 %.1f us, p99 %.1f us\n",
+                       c->spawn_ns / 1e6, p50 / 1e3, p99 / 1e3);
+    soshell_out_printf("read_line      %" PRIu64 " lines, %" PRIu64 " bytes\n",
+                       c->read_lines, c->read_bytes);
+    soshell_out_printf("arena          %" PRIu64 " allocations, %" PRIu64
+                       " blocks, high water %" PRIu64 " bytes\n",
+                       c->arena_allocs, c->arena_blocks, c->arena_high);
+  }
+  if (reset) {
+    memset(c, 0, sizeof(*c));
+  }
+  return 1;
+}
@@ -0,0 +1,39 @@
+#ifndef SOSHELL_STATS_H
+#define SOSHELL_STATS_H
+
+#include <stdint.h>
+
+#define SOSHELL_STATS_BUCKETS 496
+
+/*
+  Counters of the shell's hot paths, shown by the stats builtin.  They
+  are only updated from the shell's own thread, so they are plain
+  integers.  Spawn latencies go into a log-linear histogram: eight
+  buckets per power of two, so a percentile is within 12.5%.
+ */
+struct soshell_counters {
+  uint64_t commands;       /* lines executed */
+  uint64_t builtins;
+  uint64_t external;
+  uint64_t pipelines;
+  uint64_t assignments;
+  uint64_t forks;
+  uint64_t exec_failures;  /* children that exited with 127 */
+  uint64_t read_lines;
+  uint64_t read_bytes;
+  uint64_t arena_allocs;
+  uint64_t arena_blocks;   /* blocks malloc'd by the arena */
+  uint64_t arena_bytes;    /* in use by the current command */
+  uint64_t arena_high;     /* most arena_bytes ever reached */
+  uint64_t spawns;
+  uint64_t spawn_ns;       /* total */
+  uint64_t spawn_hist[SOSHELL_STATS_BUCKETS];
+};
+
+extern struct soshell_counters soshell_counters;
+
+uint64_t soshell_stats_spawn_begin(void);
+void soshell_stats_spawn_end(uint64_t start);
+int soshell_stats(char **args);
+
+#endif
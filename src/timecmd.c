@@ -0,0 +1,300 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+
+#include "timecmd.h"
+#include "builtin.h"
+#include "io.h"
+#include "pathcache.h"
+#include "pipeline.h"
+#include "shell.h"
+#include "stats.h"
+#include "var.h"
+
+/*
+  time [-c] command
+
+  Runs a command and reports on standard error how long it took: wall
+  clock, user and system time from rusage, peak resident set size and
+  context switches.  A simple external command is forked here and
+  reaped with wait4(), so the figures are the command's own.  A builtin
+  or a pipeline is measured as the change in getrusage() of the shell
+  and its children while it runs.
+
+  With -c, cycles, instructions and cache misses are counted as well,
+  through perf_event_open().  A forked command waits on a pipe until
+  its counters are attached; they start at its execve() (enable_on_exec)
+  so the shell's side of the fork is not counted.  Where the kernel
+  only allows user-space counting the counters are opened that way, and
+  where perf events are not allowed at all they are left out.
+ */
+
+#define TIME_NCOUNTERS 3
+
+static const struct {
+  uint32_t type;
+  uint64_t config;
+  const char *name;
+} time_events[TIME_NCOUNTERS] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses" }
+};
+
+struct time_counters {
+  int fd[TIME_NCOUNTERS];
+  int user_only;           /* kernel counting was refused */
+};
+
+static void time_perf_close(struct time_counters *c)
+{
+  int i;
+
+  for (i = 0; i < TIME_NCOUNTERS; i++) {
+    if (c->fd[i] >= 0) {
+      close(c->fd[i]);
+    }
+    c->fd[i] = -1;
+  }
+}
+
+/*
+  Open the counters for pid, or for the shell and the threads and
+  children it creates from now on if pid is 0.  A counter the hardware
+  does not have is skipped; returns -1 if none could be opened.
+ */
+static int time_perf_open(struct time_counters *c, pid_t pid)
+{
+  struct perf_event_attr attr;
+  int i, opened = 0, err = 0;
+
+  for (i = 0; i < TIME_NCOUNTERS; i++) {
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = time_events[i].type;
+    attr.config = time_events[i].config;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.enable_on_exec = (pid != 0);
+    attr.exclude_hv = 1;
+    attr.exclude_kernel = c->user_only;
+    c->fd[i] = syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (c->fd[i] >= 0) {
+      opened++;
+      continue;
+    }
+    err = errno;
+    // perf_event_paranoid 2 allows counting user space only.
+    if ((err == EACCES || err == EPERM) && !c->user_only) {
+      time_perf_close(c);
+      c->user_only = 1;
+      opened = 0;
+      i = -1;
+    }
+  }
+  if (opened == 0) {
+    fprintf(stderr, "soshell: time: no performance counters: %s\n", strerror(err));
+    return -1;
+  }
+  return 0;
+}
+
+static void time_perf_enable(struct time_counters *c, unsigned long request)
+{
+  int i;
+
+  for (i = 0; i < TIME_NCOUNTERS; i++) {
+    if (c->fd[i] >= 0) {
+      ioctl(c->fd[i], request, 0);
+    }
+  }
+}
+
+/*
+  Read a counter, scaled up if the kernel had to multiplex it.
+ */
+static int time_perf_read(int fd, uint64_t *value)
+{
+  uint64_t v[3];
+
+  if (fd < 0 || read(fd, v, sizeof(v)) != sizeof(v)) {
+    return -1;
+  }
+  *value = v[0];
+  if (v[2] > 0 && v[2] < v[1]) {
+    *value = (uint64_t)((double)v[0] * v[1] / v[2]);
+  }
+  return 0;
+}
+
+static double time_tv(const struct timeval *tv)
+{
+  return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static void time_line(const char *name, double sec)
+{
+  long min = (long)(sec / 60);
+
+  fprintf(stderr, "%s\t%ldm%.3fs\n", name, min, sec - min * 60);
+}
+
+static void time_report(double real, const struct rusage *ru, struct time_counters *c)
+{
+  uint64_t value[TIME_NCOUNTERS];
+  int have[TIME_NCOUNTERS];
+  int i;
+
+  time_line("real", real);
+  time_line("user", time_tv(&ru->ru_utime));
+  time_line("sys", time_tv(&ru->ru_stime));
+  fprintf(stderr, "maxrss\t%ld KB\n", ru->ru_maxrss);
+  fprintf(stderr, "csw\t%ld voluntary, %ld involuntary\n", ru->ru_nvcsw, ru->ru_nivcsw);
+  if (c == NULL) {
+    return;
+  }
+  for (i = 0; i < TIME_NCOUNTERS; i++) {
+    have[i] = (time_perf_read(c->fd[i], &value[i]) == 0);
+    if (have[i]) {
+      fprintf(stderr, "%s\t%llu%s", time_events[i].name,
+              (unsigned long long)value[i], c->user_only ? " (user)" : "");
+      if (i == 1 && have[0] && value[0] > 0) {
+        fprintf(stderr, "  %.2f per cycle", (double)value[1] / value[0]);
+      }
+      fputc('\n', stderr);
+    }
+  }
+}
+
+/*
+  Fork and exec a simple command, attaching the counters while the
+  child waits on the sync pipe.
+ */
+static int time_fork(char **args, struct time_counters *c, struct rusage *ru)
+{
+  char path[4096], byte;
+  int found = (soshell_path_lookup(args[0], path, sizeof(path)) == 0);
+  int sync[2], status;
+  uint64_t spawn;
+  pid_t pid;
+
+  if (pipe2(sync, O_CLOEXEC) < 0) {
+    perror("soshell: time");
+    return -1;
+  }
+  soshell_out_flush();
+  spawn = soshell_stats_spawn_begin();
+  pid = fork();
+  if (pid == 0) {
+    // Child process
+    close(sync[1]);
+    while (read(sync[0], &byte, 1) < 0 && errno == EINTR) {}
+    soshell_path_exec(found ? path : NULL, args);
+    perror("soshell");
+    exit(127);
+  }
+  close(sync[0]);
+  if (pid < 0) {
+    perror("soshell");
+    close(sync[1]);
+    return -1;
+  }
+  soshell_stats_spawn_end(spawn);
+  soshell_counters.forks++;
+  if (c != NULL && time_perf_open(c, pid) < 0) {
+    c = NULL;
+  }
+  // Closing our end lets the child go on to execve().
+  close(sync[1]);
+  while (wait4(pid, &status, 0, ru) < 0 && errno == EINTR) {}
+  soshell_record_status(status);
+  if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+    soshell_counters.exec_failures++;
+  }
+  return 0;
+}
+
+/**
+   @brief Run a command and report the time and resources it used.
+   @param args List of args.  args[0] is "time", then -c for hardware
+   counters, then the command.
+   @return The command's status: 1 to continue, 0 to exit the shell.
+ */
+int soshell_time(char **args)
+{
+  struct time_counters counters, *c = NULL;
+  struct rusage self0, child0, self1, child1, ru;
+  struct timespec t0, t1;
+  int i, simple, status = 1;
+
+  args++;
+  if (args[0] != NULL && strcmp(args[0], "-c") == 0) {
+    for (i = 0; i < TIME_NCOUNTERS; i++) {
+      counters.fd[i] = -1;
+    }
+    counters.user_only = 0;
+    c = &counters;
+    args++;
+  }
+
+  simple = args[0] != NULL && !soshell_is_pipeline(args) &&
+           soshell_find_builtin(args[0]) == NULL &&
+           !soshell_var_is_assignment(args[0]);
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if (simple) {
+    soshell_counters.external++;
+    if (time_fork(args, c, &ru) < 0) {
+      return 1;
+    }
+  } else {
+    if (c != NULL) {
+      if (time_perf_open(c, 0) < 0) {
+        c = NULL;
+      } else {
+        time_perf_enable(c, PERF_EVENT_IOC_ENABLE);
+      }
+    }
+    getrusage(RUSAGE_SELF, &self0);
+    getrusage(RUSAGE_CHILDREN, &child0);
+    status = soshell_execute(args);
+    getrusage(RUSAGE_SELF, &self1);
+    getrusage(RUSAGE_CHILDREN, &child1);
+    if (c != NULL) {
+      time_perf_enable(c, PERF_EVENT_IOC_DISABLE);
+    }
+    // What the shell and the children it reaped used in between.
+    memset(&ru, 0, sizeof(ru));
+    timersub(&self1.ru_utime, &self0.ru_utime, &self1.ru_utime);
+    timersub(&child1.ru_utime, &child0.ru_utime, &child1.ru_utime);
+    timeradd(&self1.ru_utime, &child1.ru_utime, &ru.ru_utime);
+    timersub(&self1.ru_stime, &self0.ru_stime, &self1.ru_stime);
+    timersub(&child1.ru_stime, &child0.ru_stime, &child1.ru_stime);
+    timeradd(&self1.ru_stime, &child1.ru_stime, &ru.ru_stime);
+    ru.ru_maxrss = self1.ru_maxrss > child1.ru_maxrss ? self1.ru_maxrss : child1.ru_maxrss;
+    ru.ru_nvcsw = (self1.ru_nvcsw - self0.ru_nvcsw) + (child1.ru_nvcsw - child0.ru_nvcsw);
+    ru.ru_nivcsw = (self1.ru_nivcsw - self0.ru_nivcsw) + (child1.ru_nivcsw - child0.ru_nivcsw);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  // The command's own output comes before the report.
+  soshell_out_flush();
+  time_report((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9, &ru, c);
+  if (c != NULL) {
+    time_perf_close(c);
+  }
+  return status;
+}
@@ -0,0 +1,6 @@
+#ifndef SOSHELL_TIMECMD_H
+#define SOSHELL_TIMECMD_H
+
+int soshell_time(char **args);
+
+#endif
@@ -0,0 +1,145 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/*
+  Spans go into a fixed ring of events.  A writer claims a slot with
+  one atomic increment, so the shell's thread and the builtin stages of
+  a pipeline record without a lock; once the ring is full the oldest
+  spans are overwritten.  The ring is written out from an atexit
+  handler, by the shell process only: a child that fails to exec must
+  not overwrite the file.
+ */
+
+#define TRACE_RING (1 << 16)
+#define TRACE_DETAIL 48
+
+struct trace_event {
+  const char *name;
+  char detail[TRACE_DETAIL];
+  uint64_t start;          /* ns, CLOCK_MONOTONIC */
+  uint64_t dur;
+  pid_t tid;
+};
+
+int soshell_trace_enabled;
+
+static struct trace_event *trace_ring;
+static atomic_ulong trace_next;
+static char *trace_path;
+static pid_t trace_pid;
+static __thread pid_t trace_tid;
+
+/**
+   @brief Current time for a span.
+   @return Nanoseconds on the monotonic clock.
+ */
+uint64_t soshell_trace_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+   @brief Record a span that started at start and ends now.
+   @param name Span name; must be a string constant.
+   @param detail Shown as the span's argument, or NULL.
+   @param start Value from soshell_trace_begin(); 0 records nothing.
+ */
+void soshell_trace_end(const char *name, const char *detail, uint64_t start)
+{
+  struct trace_event *ev;
+  uint64_t end;
+
+  if (start == 0 || trace_ring == NULL) {
+    return;
+  }
+  end = soshell_trace_now();
+  if (trace_tid == 0) {
+    trace_tid = gettid();
+  }
+  ev = &trace_ring[atomic_fetch_add_explicit(&trace_next, 1, memory_order_relaxed) % TRACE_RING];
+  ev->name = name;
+  ev->start = start;
+  ev->dur = end - start;
+  ev->tid = trace_tid;
+  ev->detail[0] = '\0';
+  if (detail != NULL) {
+    strncat(ev->detail, detail, TRACE_DETAIL - 1);
+  }
+}
+
+static void trace_json_string(FILE *f, const char *s)
+{
+  fputc('"', f);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') {
+      fputc('\\', f);
+      fputc(*s, f);
+    } else if ((unsigned char)*s < 0x20) {
+      fprintf(f, "\\u%04x", (unsigned char)*s);
+    } else {
+      fputc(*s, f);
+    }
+  }
+  fputc('"', f);
+}
+
+static void trace_dump(void)
+{
+  unsigned long n = atomic_load(&trace_next), i;
+  struct trace_event *ev;
+  FILE *f;
+
+  if (getpid() != trace_pid) {
+    return;
+  }
+  f = fopen(trace_path, "w");
+  if (f == NULL) {
+    perror("soshell: trace");
+    return;
+  }
+  fputs("{\"traceEvents\":[\n", f);
+  for (i = (n > TRACE_RING) ? n - TRACE_RING : 0; i < n; i++) {
+    ev = &trace_ring[i % TRACE_RING];
+    fprintf(f, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+            ev->name, (int)trace_pid, (int)ev->tid, ev->start / 1e3, ev->dur / 1e3);
+    if (ev->detail[0] != '\0') {
+      fputs(",\"args\":{\"cmd\":", f);
+      trace_json_string(f, ev->detail);
+      fputc('}', f);
+    }
+    fputs(i + 1 < n ? "},\n" : "}\n", f);
+  }
+  fputs("],\"displayTimeUnit\":\"ns\"}\n", f);
+  fclose(f);
+}
+
+/**
+   @brief Turn tracing on if SOSHELL_TRACE names an output file.
+ */
+void soshell_trace_init(void)
+{
+  const char *path = getenv("SOSHELL_TRACE");
+
+  if (path == NULL || path[0] == '\0') {
+    return;
+  }
+  trace_ring = calloc(TRACE_RING, sizeof(*trace_ring));
+  trace_path = strdup(path);
+  if (!trace_ring || !trace_path) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  trace_pid = getpid();
+  atexit(trace_dump);
+  soshell_trace_enabled = 1;
+}
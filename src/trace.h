@@ -0,0 +1,23 @@
+#ifndef SOSHELL_TRACE_H
+#define SOSHELL_TRACE_H
+
+#include <stdint.h>
+
+/*
+  Opt-in tracing: with SOSHELL_TRACE=file in the environment, spans of
+  the shell's work are recorded and written to file as Chrome trace
+  JSON when the shell exits.  soshell_trace_begin() returns 0 when
+  tracing is off, and soshell_trace_end() then records nothing.
+ */
+extern int soshell_trace_enabled;
+
+void soshell_trace_init(void);
+uint64_t soshell_trace_now(void);
+void soshell_trace_end(const char *name, const char *detail, uint64_t start);
+
+static inline uint64_t soshell_trace_begin(void)
+{
+  return soshell_trace_enabled ? soshell_trace_now() : 0;
+}
+
+#endif
@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "var.h"
+
+#define SOSHELL_VAR_BUCKETS 256
+
+static struct soshell_var *var_table[SOSHELL_VAR_BUCKETS];
+
+static unsigned long var_hash(const char *name, size_t len)
+{
+  unsigned long h = 2166136261UL;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    h = (h ^ (unsigned char)name[i]) * 16777619UL;
+  }
+  return h;
+}
+
+/**
+   @brief Check whether a string is a valid variable name.
+   @param name Start of the name.
+   @param len Length of the name.
+   @return 1 if valid, 0 otherwise.
+ */
+int soshell_var_is_name(const char *name, size_t len)
+{
+  size_t i;
+
+  if (len == 0 || (name[0] >= '0' && name[0] <= '9')) {
+    return 0;
+  }
+  for (i = 0; i < len; i++) {
+    char c = name[i];
+    if (!(c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+          (c >= '0' && c <= '9'))) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+   @brief Find a variable by name.
+   @param name Start of the name (need not be NUL terminated).
+   @param len Length of the name.
+   @param create If non-zero, create an unset entry when none exists.
+   @return The variable, or NULL if it does not exist and create is 0.
+ */
+struct soshell_var *soshell_var_lookup(const char *name, size_t len, int create)
+{
+  unsigned long slot = var_hash(name, len) % SOSHELL_VAR_BUCKETS;
+  struct soshell_var *var;
+
+  for (var = var_table[slot]; var != NULL; var = var->next) {
+    if (strncmp(var->name, name, len) == 0 && var->name[len] == '\0') {
+      return var;
+    }
+  }
+  if (!create) {
+    return NULL;
+  }
+
+  var = calloc(1, sizeof(*var));
+  if (var != NULL) {
+    var->name = malloc(len + 1);
+  }
+  if (var == NULL || var->name == NULL) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(var->name, name, len);
+  var->name[len] = '\0';
+  var->next = var_table[slot];
+  var_table[slot] = var;
+  return var;
+}
+
+/*
+  Parse a plain decimal integer, as produced by soshell_var_set_int.
+  Anything else (hex, octal, spaces) is left for the arithmetic
+  evaluator to interpret on demand.
+ */
+static int var_parse_int(const char *s, int64_t *out)
+{
+  const char *p = s;
+  uint64_t n = 0;
+  int neg = 0;
+
+  if (*p == '-') {
+    neg = 1;
+    p++;
+  }
+  if (*p < '0' || *p > '9' || (*p == '0' && p[1] != '\0')) {
+    return 0;
+  }
+  for (; *p >= '0' && *p <= '9'; p++) {
+    if (n > (UINT64_MAX - 9) / 10) {
+      return 0;
+    }
+    n = n * 10 + (*p - '0');
+  }
+  if (*p != '\0' || n > (uint64_t)INT64_MAX + neg) {
+    return 0;
+  }
+  *out = neg ? (int64_t)(0 - n) : (int64_t)n;
+  return 1;
+}
+
+/**
+   @brief Assign a string value to a variable.
+   @param var The variable.
+   @param value New value, copied.
+ */
+void soshell_var_set(struct soshell_var *var, const char *value)
+{
+  char *copy = strdup(value);
+
+  if (copy == NULL) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  free(var->value);
+  var->value = copy;
+  var->has_int = var_parse_int(copy, &var->ival);
+  var->set = 1;
+}
+
+/**
+   @brief Assign an integer value to a variable without formatting it.
+   @param var The variable.
+   @param value New value.
+ */
+void soshell_var_set_int(struct soshell_var *var, int64_t value)
+{
+  free(var->value);
+  var->value = NULL;
+  var->ival = value;
+  var->has_int = 1;
+  var->set = 1;
+}
+
+/**
+   @brief Get the string value of a variable.
+   @param var The variable.
+   @return The value, or NULL if the variable is unset.
+ */
+const char *soshell_var_value(struct soshell_var *var)
+{
+  char buf[32];
+
+  if (!var->set) {
+    return NULL;
+  }
+  if (var->value == NULL) {
+    snprintf(buf, sizeof(buf), "%" PRId64, var->ival);
+    var->value = strdup(buf);
+    if (var->value == NULL) {
+      fprintf(stderr, "soshell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  return var->value;
+}
+
+/**
+   @brief Check whether a word has the form NAME=value.
+   @param word The word.
+   @return 1 if it does, 0 otherwise.
+ */
+int soshell_var_is_assignment(const char *word)
+{
+  const char *eq = strchr(word, '=');
+
+  return eq != NULL && soshell_var_is_name(word, eq - word);
+}
+
+/**
+   @brief Perform a NAME=value assignment word.
+   @param word The word.
+   @return 1 if the word was an assignment, 0 otherwise.
+ */
+int soshell_var_assign(const char *word)
+{
+  const char *eq = strchr(word, '=');
+
+  if (!soshell_var_is_assignment(word)) {
+    return 0;
+  }
+  soshell_var_set(soshell_var_lookup(word, eq - word, 1), eq + 1);
+  return 1;
+}
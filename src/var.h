@@ -0,0 +1,30 @@
+#ifndef SOSHELL_VAR_H
+#define SOSHELL_VAR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+  Shell variable.  Entries are never freed once created, so other
+  subsystems (e.g. compiled arithmetic expressions) may keep pointers
+  to them.  A variable can hold its value as a string, as an integer,
+  or both; the string form of an integer is only built when asked for.
+ */
+struct soshell_var {
+  char *name;
+  char *value;       /* string value, NULL if not (yet) formatted */
+  int64_t ival;      /* integer value, valid when has_int is set */
+  int has_int;
+  int set;           /* 0 if the variable is unset */
+  struct soshell_var *next;
+};
+
+struct soshell_var *soshell_var_lookup(const char *name, size_t len, int create);
+void soshell_var_set(struct soshell_var *var, const char *value);
+void soshell_var_set_int(struct soshell_var *var, int64_t value);
+const char *soshell_var_value(struct soshell_var *var);
+int soshell_var_is_name(const char *name, size_t len);
+int soshell_var_is_assignment(const char *word);
+int soshell_var_assign(const char *word);
+
+#endif
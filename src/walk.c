@@ -0,0 +1,274 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "walk.h"
+#include "io.h"
+#include "pool.h"
+
+/*
+  Every directory to read is a pool task.  It is opened, listed with
+  getdents64 and, where needed, its entries are stat'ed with fstatat
+  relative to it; subdirectories become tasks of their own.  A
+  directory holds one reference for its own listing and one for each
+  subdirectory not yet complete, and is left when the count drops to
+  zero, which then releases its parent.
+ */
+
+#define WALK_READBUF (32 * 1024)
+#define WALK_MIN_THREADS 4
+
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+struct soshell_walk {
+  const struct soshell_walk_ops *ops;
+  struct soshell_pool *pool;
+  struct soshell_out *out;
+  pthread_mutex_t lock;
+  atomic_int errors;
+};
+
+struct walk_dir {
+  struct soshell_walk *walk;
+  struct walk_dir *parent;
+  void *data;
+  int depth;
+  atomic_long refs;
+  size_t len;
+  char path[];
+};
+
+static void walk_error(struct soshell_walk *walk, const char *path)
+{
+  fprintf(stderr, "soshell: %s: %s: %s\n", walk->ops->cmd, path, strerror(errno));
+  atomic_fetch_add(&walk->errors, 1);
+}
+
+static void walk_release(struct walk_dir *dir)
+{
+  struct soshell_walk *walk = dir->walk;
+  struct soshell_walk_ent ent;
+  struct walk_dir *parent;
+  const char *slash;
+
+  while (dir != NULL && atomic_fetch_sub(&dir->refs, 1) == 1) {
+    parent = dir->parent;
+    if (walk->ops->leave) {
+      slash = strrchr(dir->path, '/');
+      ent.path = dir->path;
+      ent.name = (slash && slash[1] != '\0') ? slash + 1 : dir->path;
+      ent.depth = dir->depth;
+      ent.type = DT_DIR;
+      ent.st = NULL;
+      ent.parent = parent ? parent->data : NULL;
+      walk->ops->leave(walk, &ent, dir->data);
+    }
+    free(dir);
+    dir = parent;
+  }
+}
+
+static void walk_dir_run(void *arg);
+
+static void walk_push(struct soshell_walk *walk, struct walk_dir *parent,
+                      const char *path, size_t len, int depth, void *data)
+{
+  struct walk_dir *dir = malloc(sizeof(*dir) + len + 1);
+
+  if (!dir) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  dir->walk = walk;
+  dir->parent = parent;
+  dir->data = data;
+  dir->depth = depth;
+  atomic_init(&dir->refs, 1);
+  dir->len = len;
+  memcpy(dir->path, path, len);
+  dir->path[len] = '\0';
+  if (parent) {
+    atomic_fetch_add(&parent->refs, 1);
+  }
+  soshell_pool_submit(walk->pool, walk_dir_run, dir);
+}
+
+static void walk_dir_run(void *arg)
+{
+  struct walk_dir *dir = arg;
+  struct soshell_walk *walk = dir->walk;
+  const struct soshell_walk_ops *ops = walk->ops;
+  struct soshell_out *saved = soshell_out;
+  struct soshell_walk_ent ent;
+  struct linux_dirent64 *d;
+  struct stat st;
+  size_t len = dir->len, cap = dir->len + 256, namelen;
+  char *buf, *path;
+  void *data;
+  long nread, pos;
+  int fd;
+
+  // Also for walk_release(): the leave callbacks of finished
+  // directories print from here.
+  soshell_out = walk->out;
+  fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd < 0) {
+    walk_error(walk, dir->path);
+    walk_release(dir);
+    soshell_out = saved;
+    return;
+  }
+  buf = malloc(WALK_READBUF);
+  path = malloc(cap);
+  if (!buf || !path) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(path, dir->path, len);
+  if (len == 0 || path[len - 1] != '/') {
+    path[len++] = '/';
+  }
+
+  for (;;) {
+    nread = syscall(SYS_getdents64, fd, buf, WALK_READBUF);
+    if (nread < 0) {
+      walk_error(walk, dir->path);
+      break;
+    }
+    if (nread == 0) {
+      break;
+    }
+    for (pos = 0; pos < nread; pos += d->d_reclen) {
+      d = (struct linux_dirent64 *)(buf + pos);
+      if (d->d_name[0] == '.' && (d->d_name[1] == '\0' ||
+                                  (d->d_name[1] == '.' && d->d_name[2] == '\0'))) {
+        continue;
+      }
+      namelen = strlen(d->d_name);
+      if (len + namelen + 1 > cap) {
+        cap = 2 * (len + namelen + 1);
+        path = realloc(path, cap);
+        if (!path) {
+          fprintf(stderr, "soshell: allocation error\n");
+          exit(EXIT_FAILURE);
+        }
+      }
+      memcpy(path + len, d->d_name, namelen + 1);
+
+      ent.path = path;
+      ent.name = path + len;
+      ent.depth = dir->depth + 1;
+      ent.type = d->d_type;
+      ent.st = NULL;
+      ent.parent = dir->data;
+      if (ops->want_stat || d->d_type == DT_UNKNOWN) {
+        if (fstatat(fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+          walk_error(walk, path);
+          continue;
+        }
+        ent.st = &st;
+        ent.type = IFTODT(st.st_mode);
+      }
+      data = NULL;
+      if (ops->visit(walk, &ent, &data) && ent.type == DT_DIR) {
+        walk_push(walk, dir, path, len + namelen, ent.depth, data);
+      }
+    }
+  }
+
+  close(fd);
+  free(buf);
+  free(path);
+  walk_release(dir);
+  soshell_out = saved;
+}
+
+/**
+   @brief Walk directory trees in parallel.
+   @param roots Null terminated list of paths to start from.  Roots are
+   not followed if they are symbolic links.
+   @param ops Callbacks.
+   @return 0 on success, -1 if any entry could not be read.
+ */
+int soshell_walk(char **roots, const struct soshell_walk_ops *ops)
+{
+  struct soshell_walk walk;
+  struct soshell_walk_ent ent;
+  struct stat st;
+  const char *slash;
+  void *data;
+  int i, n = soshell_ncpus();
+
+  walk.ops = ops;
+  walk.out = soshell_out_current();
+  pthread_mutex_init(&walk.lock, NULL);
+  atomic_init(&walk.errors, 0);
+  // Reading directories waits on the disk as much as on the CPU.
+  walk.pool = soshell_pool_create(n < WALK_MIN_THREADS ? WALK_MIN_THREADS : n);
+
+  for (i = 0; roots[i] != NULL; i++) {
+    if (lstat(roots[i], &st) != 0) {
+      walk_error(&walk, roots[i]);
+      continue;
+    }
+    slash = strrchr(roots[i], '/');
+    ent.path = roots[i];
+    ent.name = (slash && slash[1] != '\0') ? slash + 1 : roots[i];
+    ent.depth = 0;
+    ent.type = IFTODT(st.st_mode);
+    ent.st = &st;
+    ent.parent = NULL;
+    data = NULL;
+    if (ops->visit(&walk, &ent, &data) && S_ISDIR(st.st_mode)) {
+      walk_push(&walk, NULL, roots[i], strlen(roots[i]), 0, data);
+    }
+  }
+
+  soshell_pool_destroy(walk.pool);
+  pthread_mutex_destroy(&walk.lock);
+  return atomic_load(&walk.errors) ? -1 : 0;
+}
+
+/**
+   @brief Get the ctx pointer of a walk's ops.
+   @param walk The walk.
+   @return ops->ctx.
+ */
+void *soshell_walk_ctx(struct soshell_walk *walk)
+{
+  return walk->ops->ctx;
+}
+
+/**
+   @brief Serialize output and other shared state between callbacks.
+   @param walk The walk.
+ */
+void soshell_walk_lock(struct soshell_walk *walk)
+{
+  pthread_mutex_lock(&walk->lock);
+}
+
+/**
+   @brief Release the lock taken by soshell_walk_lock().
+   @param walk The walk.
+ */
+void soshell_walk_unlock(struct soshell_walk *walk)
+{
+  pthread_mutex_unlock(&walk->lock);
+}
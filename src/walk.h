@@ -0,0 +1,43 @@
+#ifndef SOSHELL_WALK_H
+#define SOSHELL_WALK_H
+
+#include <sys/stat.h>
+
+/*
+  Parallel directory tree walk shared by builtins such as du and find.
+  Directories are read on a pool of worker threads, so callbacks run
+  concurrently and in no particular order between siblings; a
+  directory's leave callback runs only after everything below it has
+  been visited and left.  Callbacks run with the calling builtin's
+  output buffer as theirs, and must hold the walk lock while writing.
+ */
+struct soshell_walk;
+
+struct soshell_walk_ent {
+  const char *path;        /* full path, valid during the callback */
+  const char *name;        /* last component of path */
+  int depth;               /* 0 for a root */
+  unsigned char type;      /* DT_* */
+  const struct stat *st;   /* lstat of the entry, NULL if not asked for */
+  void *parent;            /* data of the containing directory, NULL at a root */
+};
+
+struct soshell_walk_ops {
+  const char *cmd;         /* builtin name for error messages */
+  int want_stat;           /* stat every entry, not only roots */
+  /*
+    Called for every entry.  For a directory, return 1 to descend into
+    it; *data is handed to its children as parent and to leave.
+   */
+  int (*visit)(struct soshell_walk *walk, const struct soshell_walk_ent *ent, void **data);
+  /* Called once a directory descended into is complete; may be NULL. */
+  void (*leave)(struct soshell_walk *walk, const struct soshell_walk_ent *ent, void *data);
+  void *ctx;
+};
+
+int soshell_walk(char **roots, const struct soshell_walk_ops *ops);
+void *soshell_walk_ctx(struct soshell_walk *walk);
+void soshell_walk_lock(struct soshell_walk *walk);
+void soshell_walk_unlock(struct soshell_walk *walk);
+
+#endif
@@ -0,0 +1,380 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "wc.h"
+#include "io.h"
+#include "job.h"
+#include "pool.h"
+
+/*
+  wc [-l] [-w] [-c] [file...]
+
+  Counting is done 32 (AVX2) or 16 (SSE2) bytes at a time: a compare
+  and movemask give a bit per byte for newlines and for white space,
+  and word starts are the non-space bits whose previous bit is space.
+  The kernel is picked once at run time.  A large regular file is cut
+  into one contiguous chunk per worker; each chunk is counted on its
+  own and a word split across a chunk boundary is counted once.
+ */
+
+#define WC_BUFSIZE (1024 * 1024)
+#define WC_PARALLEL_MIN (64L * 1024 * 1024)
+
+struct wc_counts {
+  uint64_t lines;
+  uint64_t words;
+  uint64_t bytes;
+  int in_word;             /* the last byte seen was not white space */
+  int starts_in_word;      /* the first byte was not white space */
+};
+
+typedef void (*wc_kernel_fn)(const unsigned char *p, size_t n, struct wc_counts *c, int words);
+
+static int wc_isspace(unsigned char c)
+{
+  return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+static void wc_count_scalar(const unsigned char *p, size_t n, struct wc_counts *c, int words)
+{
+  size_t i;
+  int in_word = c->in_word;
+
+  for (i = 0; i < n; i++) {
+    c->lines += (p[i] == '\n');
+    if (words) {
+      if (wc_isspace(p[i])) {
+        in_word = 0;
+      } else {
+        c->words += !in_word;
+        in_word = 1;
+      }
+    }
+  }
+  c->in_word = in_word;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2,popcnt")))
+static void wc_count_sse2(const unsigned char *p, size_t n, struct wc_counts *c, int words)
+{
+  const __m128i nl = _mm_set1_epi8('\n'), sp = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t'), span = _mm_set1_epi8('\r' - '\t');
+  uint32_t prev = !c->in_word, m, s;
+  uint64_t lines = 0, nwords = 0;
+  size_t i;
+  __m128i v, t;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    v = _mm_loadu_si128((const __m128i *)(p + i));
+    m = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+    lines += __builtin_popcount(m);
+    if (words) {
+      // White space is ' ' or '\t'..'\r', i.e. (c - '\t') <= 4 unsigned.
+      t = _mm_sub_epi8(v, tab);
+      t = _mm_cmpeq_epi8(_mm_min_epu8(t, span), t);
+      s = (uint32_t)_mm_movemask_epi8(_mm_or_si128(t, _mm_cmpeq_epi8(v, sp)));
+      nwords += __builtin_popcount(~s & ((s << 1) | prev) & 0xffff);
+      prev = s >> 15;
+    }
+  }
+  c->lines += lines;
+  c->words += nwords;
+  if (words) {
+    c->in_word = !prev;
+  }
+  wc_count_scalar(p + i, n - i, c, words);
+}
+
+__attribute__((target("avx2,popcnt")))
+static void wc_count_avx2(const unsigned char *p, size_t n, struct wc_counts *c, int words)
+{
+  const __m256i nl = _mm256_set1_epi8('\n'), sp = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t'), span = _mm256_set1_epi8('\r' - '\t');
+  uint32_t prev = !c->in_word, m, s;
+  uint64_t lines = 0, nwords = 0;
+  size_t i;
+  __m256i v, t;
+
+  for (i = 0; i + 32 <= n; i += 32) {
+    v = _mm256_loadu_si256((const __m256i *)(p + i));
+    m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+    lines += __builtin_popcount(m);
+    if (words) {
+      t = _mm256_sub_epi8(v, tab);
+      t = _mm256_cmpeq_epi8(_mm256_min_epu8(t, span), t);
+      s = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(t, _mm256_cmpeq_epi8(v, sp)));
+      nwords += __builtin_popcount(~s & ((s << 1) | prev));
+      prev = s >> 31;
+    }
+  }
+  c->lines += lines;
+  c->words += nwords;
+  if (words) {
+    c->in_word = !prev;
+  }
+  wc_count_scalar(p + i, n - i, c, words);
+}
+#endif
+
+static wc_kernel_fn wc_kernel(void)
+{
+  static wc_kernel_fn kernel;
+
+  if (kernel == NULL) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+      kernel = wc_count_avx2;
+    } else if (__builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt")) {
+      kernel = wc_count_sse2;
+    } else {
+      kernel = wc_count_scalar;
+    }
+#else
+    kernel = wc_count_scalar;
+#endif
+  }
+  return kernel;
+}
+
+static unsigned char *wc_buffer(void)
+{
+  unsigned char *buf;
+
+  if (posix_memalign((void **)&buf, 64, WC_BUFSIZE) != 0) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  return buf;
+}
+
+/*
+  Count from the current position of fd to end of file.
+ */
+static int wc_count_stream(int fd, struct wc_counts *c, int words)
+{
+  wc_kernel_fn kernel = wc_kernel();
+  unsigned char *buf = wc_buffer();
+  ssize_t n;
+
+  for (;;) {
+    n = read(fd, buf, WC_BUFSIZE);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      free(buf);
+      return (int)n;
+    }
+    kernel(buf, n, c, words);
+    c->bytes += n;
+    soshell_job_yield();
+  }
+}
+
+struct wc_chunk {
+  int fd;
+  off_t start;
+  off_t end;
+  int words;
+  int error;
+  struct wc_counts counts;
+};
+
+static void wc_chunk_run(void *arg)
+{
+  struct wc_chunk *chunk = arg;
+  wc_kernel_fn kernel = wc_kernel();
+  unsigned char *buf = wc_buffer();
+  off_t pos = chunk->start;
+  size_t want;
+  ssize_t n;
+
+  while (pos < chunk->end) {
+    want = (chunk->end - pos < WC_BUFSIZE) ? (size_t)(chunk->end - pos) : WC_BUFSIZE;
+    n = pread(chunk->fd, buf, want, pos);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      chunk->error = (n < 0) ? errno : 0;
+      break;
+    }
+    if (pos == chunk->start) {
+      chunk->counts.starts_in_word = !wc_isspace(buf[0]);
+    }
+    kernel(buf, n, &chunk->counts, chunk->words);
+    chunk->counts.bytes += n;
+    pos += n;
+  }
+  free(buf);
+}
+
+/*
+  Count a large regular file in parallel chunks.
+ */
+static int wc_count_parallel(int fd, off_t size, struct wc_counts *c, int words)
+{
+  struct soshell_pool *pool = soshell_pool_create(0);
+  int nchunks = soshell_pool_nthreads(pool), i, error = 0;
+  struct wc_chunk *chunks;
+
+  if (nchunks < 1) {
+    nchunks = 1;
+  }
+  chunks = calloc(nchunks, sizeof(*chunks));
+  if (!chunks) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < nchunks; i++) {
+    chunks[i].fd = fd;
+    chunks[i].start = size / nchunks * i;
+    chunks[i].end = (i == nchunks - 1) ? size : size / nchunks * (i + 1);
+    chunks[i].words = words;
+    soshell_pool_submit(pool, wc_chunk_run, &chunks[i]);
+  }
+  soshell_pool_destroy(pool);
+
+  for (i = 0; i < nchunks; i++) {
+    c->lines += chunks[i].counts.lines;
+    c->words += chunks[i].counts.words;
+    c->bytes += chunks[i].counts.bytes;
+    // A word running across the boundary was counted by both chunks.
+    if (i > 0 && chunks[i - 1].counts.in_word && chunks[i].counts.starts_in_word) {
+      c->words--;
+    }
+    if (chunks[i].error) {
+      error = chunks[i].error;
+    }
+  }
+  c->in_word = chunks[nchunks - 1].counts.in_word;
+  free(chunks);
+  if (error) {
+    errno = error;
+    return -1;
+  }
+  return 0;
+}
+
+static int wc_count_fd(int fd, struct wc_counts *c, int lines, int words)
+{
+  struct stat st;
+  off_t pos;
+
+  if (fstat(fd, &st) != 0) {
+    return -1;
+  }
+  if (S_ISREG(st.st_mode) && (pos = lseek(fd, 0, SEEK_CUR)) >= 0) {
+    if (!lines && !words) {
+      // Only bytes were asked for: the size says it all.
+      c->bytes = (st.st_size > pos) ? st.st_size - pos : 0;
+      return 0;
+    }
+    if (pos == 0 && st.st_size >= WC_PARALLEL_MIN && soshell_ncpus() > 1) {
+      return wc_count_parallel(fd, st.st_size, c, words);
+    }
+  }
+  return wc_count_stream(fd, c, words);
+}
+
+static void wc_print(const struct wc_counts *c, int lines, int words, int bytes,
+                     const char *name)
+{
+  const char *sep = "";
+
+  if (lines) {
+    soshell_out_printf("%7" PRIu64, c->lines);
+    sep = " ";
+  }
+  if (words) {
+    soshell_out_printf("%s%7" PRIu64, sep, c->words);
+    sep = " ";
+  }
+  if (bytes) {
+    soshell_out_printf("%s%7" PRIu64, sep, c->bytes);
+  }
+  if (name != NULL) {
+    soshell_out_printf(" %s", name);
+  }
+  soshell_out_write("\n", 1);
+}
+
+/**
+   @brief Builtin command: count lines, words and bytes.
+   @param args List of args.  Options -l, -w, -c, then files; no files
+   or "-" means standard input.
+   @return Always returns 1, to continue executing.
+ */
+int soshell_wc(char **args)
+{
+  struct wc_counts c, total;
+  int lines = 0, words = 0, bytes = 0, i, fd, nfiles;
+  const char *opt;
+  char **files;
+
+  for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+    for (opt = args[i] + 1; *opt; opt++) {
+      if (*opt == 'l') {
+        lines = 1;
+      } else if (*opt == 'w') {
+        words = 1;
+      } else if (*opt == 'c') {
+        bytes = 1;
+      } else {
+        fprintf(stderr, "soshell: wc: unknown option -%c\n", *opt);
+        return 1;
+      }
+    }
+  }
+  if (!lines && !words && !bytes) {
+    lines = words = bytes = 1;
+  }
+  files = args + i;
+  for (nfiles = 0; files[nfiles] != NULL; nfiles++) {}
+
+  memset(&total, 0, sizeof(total));
+  if (nfiles == 0) {
+    memset(&c, 0, sizeof(c));
+    if (wc_count_fd(soshell_in_fd, &c, lines, words) != 0) {
+      fprintf(stderr, "soshell: wc: %s\n", strerror(errno));
+    }
+    wc_print(&c, lines, words, bytes, NULL);
+    return 1;
+  }
+
+  for (i = 0; i < nfiles; i++) {
+    memset(&c, 0, sizeof(c));
+    fd = (strcmp(files[i], "-") == 0) ? soshell_in_fd : open(files[i], O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      fprintf(stderr, "soshell: wc: %s: %s\n", files[i], strerror(errno));
+      continue;
+    }
+    if (wc_count_fd(fd, &c, lines, words) != 0) {
+      fprintf(stderr, "soshell: wc: %s: %s\n", files[i], strerror(errno));
+    }
+    if (fd != soshell_in_fd) {
+      close(fd);
+    }
+    wc_print(&c, lines, words, bytes, files[i]);
+    total.lines += c.lines;
+    total.words += c.words;
+    total.bytes += c.bytes;
+  }
+  if (nfiles > 1) {
+    wc_print(&total, lines, words, bytes, "total");
+  }
+  return 1;
+}
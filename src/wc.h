@@ -0,0 +1,6 @@
+#ifndef SOSHELL_WC_H
+#define SOSHELL_WC_H
+
+int soshell_wc(char **args);
+
+#endif
@@ -0,0 +1,415 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+#include "xargs.h"
+#include "io.h"
+#include "job.h"
+#include "pathcache.h"
+#include "pool.h"
+
+/*
+  xargs [-0] [-n max] [-P procs] [command [arg...]]
+
+  Items read from standard input are appended to the command, as many
+  per invocation as the kernel accepts: ARG_MAX less the environment,
+  the initial arguments and the 2048 bytes of headroom POSIX asks for.
+  With -P, up to that many commands run at once; the shell waits on
+  pidfds so that the first to finish frees its slot.  The command is
+  looked up once in the PATH cache.
+ */
+
+#define XARGS_BUFSIZE (64 * 1024)
+#define XARGS_HEADROOM 2048
+#define XARGS_MAX_ARG (32 * 4096)  /* MAX_ARG_STRLEN on Linux */
+
+extern char **environ;
+
+struct xargs_ctx {
+  char **init;             /* command and initial arguments */
+  int ninit;
+  long maxargs;            /* -n, or 0 for no limit */
+  long budget;             /* bytes left for items */
+  const char *path;        /* command from the PATH cache, or NULL */
+  int out_fd;
+  char *items;             /* items of the pending batch, NUL separated */
+  size_t len;
+  size_t cap;
+  long nitems;
+  long used;               /* budget taken by the pending batch */
+  int ran;
+  int nprocs;
+  int nrunning;
+  pid_t *pids;
+  int *pidfds;
+};
+
+static long xargs_budget(char **init, int ninit)
+{
+  long max = sysconf(_SC_ARG_MAX), used = sizeof(char *);
+  char **e;
+  int i;
+
+  if (max <= 0) {
+    max = 128 * 1024;
+  }
+  for (e = environ; *e != NULL; e++) {
+    used += strlen(*e) + 1 + sizeof(char *);
+  }
+  for (i = 0; i < ninit; i++) {
+    used += strlen(init[i]) + 1 + sizeof(char *);
+  }
+  return max - used - XARGS_HEADROOM;
+}
+
+/*
+  Forget command i, which has been waited for.
+ */
+static void xargs_remove(struct xargs_ctx *ctx, int i)
+{
+  if (ctx->pidfds[i] >= 0) {
+    close(ctx->pidfds[i]);
+  }
+  ctx->nrunning--;
+  ctx->pids[i] = ctx->pids[ctx->nrunning];
+  ctx->pidfds[i] = ctx->pidfds[ctx->nrunning];
+}
+
+static void xargs_reap(struct xargs_ctx *ctx, int i)
+{
+  int status;
+
+  while (waitpid(ctx->pids[i], &status, 0) < 0 && errno == EINTR) {}
+  xargs_remove(ctx, i);
+}
+
+/*
+  Without pidfds: check each command in turn, sleeping a little longer
+  each round.  waitpid(-1) could reap children that are not ours, such
+  as background commands of the shell.
+ */
+static void xargs_poll_pids(struct xargs_ctx *ctx)
+{
+  struct timespec delay = { 0, 1000000 };
+  int i, status;
+  pid_t pid;
+
+  for (;;) {
+    for (i = 0; i < ctx->nrunning; i++) {
+      pid = waitpid(ctx->pids[i], &status, WNOHANG);
+      if (pid == ctx->pids[i] || (pid < 0 && errno == ECHILD)) {
+        xargs_remove(ctx, i);
+        return;
+      }
+    }
+    nanosleep(&delay, NULL);
+    if (delay.tv_nsec < 16000000) {
+      delay.tv_nsec *= 2;
+    }
+  }
+}
+
+/*
+  Wait for whichever command finishes first.
+ */
+static void xargs_wait_one(struct xargs_ctx *ctx)
+{
+  struct pollfd fds[64];
+  int i, n = ctx->nrunning;
+
+  for (i = 0; i < n; i++) {
+    if (ctx->pidfds[i] < 0) {
+      xargs_poll_pids(ctx);
+      return;
+    }
+    fds[i].fd = ctx->pidfds[i];
+    fds[i].events = POLLIN;
+  }
+  for (;;) {
+    // In a background job, the shell runs meanwhile.
+    soshell_job_wait_fds(fds, n);
+    if (poll(fds, n, 0) < 0 && errno != EINTR) {
+      xargs_poll_pids(ctx);
+      return;
+    }
+    for (i = 0; i < n; i++) {
+      if (fds[i].revents) {
+        xargs_reap(ctx, i);
+        return;
+      }
+    }
+  }
+}
+
+static void xargs_child(struct xargs_ctx *ctx, char **argv)
+{
+  sigset_t none;
+  char path[64];
+  int fd;
+
+  // Builtins on a thread run with every signal blocked.
+  sigemptyset(&none);
+  sigprocmask(SIG_SETMASK, &none, NULL);
+  // Our standard input is the item stream; the command gets nothing.
+  fd = open("/dev/null", O_RDONLY);
+  if (fd >= 0 && fd != STDIN_FILENO) {
+    dup2(fd, STDIN_FILENO);
+    close(fd);
+  }
+  fd = ctx->out_fd;
+  if ((fcntl(fd, F_GETFL) & O_NONBLOCK) != 0) {
+    /*
+      The output of a background job does not block (see job.c); the
+      command expects one that does.  Clearing the flag would clear it
+      for the job too, so open a file of its own.
+     */
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", ctx->out_fd);
+    fd = open(path, O_WRONLY | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0) {
+      fd = ctx->out_fd;
+    }
+  }
+  if (fd != STDOUT_FILENO) {
+    dup2(fd, STDOUT_FILENO);
+  }
+  soshell_path_exec(ctx->path, argv);
+  perror("soshell: xargs");
+  _exit(127);
+}
+
+static void xargs_run(struct xargs_ctx *ctx)
+{
+  char **argv = malloc((ctx->ninit + ctx->nitems + 1) * sizeof(char *));
+  char *p = ctx->items;
+  pid_t pid;
+  long i;
+
+  if (!argv) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(argv, ctx->init, ctx->ninit * sizeof(char *));
+  for (i = 0; i < ctx->nitems; i++) {
+    argv[ctx->ninit + i] = p;
+    p += strlen(p) + 1;
+  }
+  argv[ctx->ninit + ctx->nitems] = NULL;
+
+  if (ctx->nrunning == ctx->nprocs) {
+    xargs_wait_one(ctx);
+  }
+  soshell_out_flush();
+  pid = fork();
+  if (pid == 0) {
+    xargs_child(ctx, argv);
+  } else if (pid < 0) {
+    perror("soshell: xargs");
+  } else {
+    ctx->pids[ctx->nrunning] = pid;
+    ctx->pidfds[ctx->nrunning] = syscall(SYS_pidfd_open, pid, 0);
+    ctx->nrunning++;
+  }
+  free(argv);
+  ctx->len = 0;
+  ctx->nitems = 0;
+  ctx->used = 0;
+  ctx->ran = 1;
+}
+
+/*
+  Add one item to the batch, running the batch first if it would not
+  fit.
+ */
+static void xargs_add(struct xargs_ctx *ctx, const char *item, size_t len)
+{
+  long cost = len + 1 + sizeof(char *);
+
+  if (len >= XARGS_MAX_ARG) {
+    fprintf(stderr, "soshell: xargs: argument too long\n");
+    return;
+  }
+  if (ctx->nitems > 0 && (ctx->used + cost > ctx->budget ||
+                          (ctx->maxargs > 0 && ctx->nitems == ctx->maxargs))) {
+    xargs_run(ctx);
+  }
+  if (ctx->len + len + 1 > ctx->cap) {
+    ctx->cap = 2 * (ctx->len + len + 1);
+    ctx->items = realloc(ctx->items, ctx->cap);
+    if (!ctx->items) {
+      fprintf(stderr, "soshell: allocation error\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memcpy(ctx->items + ctx->len, item, len);
+  ctx->items[ctx->len + len] = '\0';
+  ctx->len += len + 1;
+  ctx->nitems++;
+  ctx->used += cost;
+}
+
+/*
+  Split input into items: on NULs with -0, otherwise on blanks and
+  newlines, with '...', "..." and backslash quoting.
+ */
+static void xargs_read(struct xargs_ctx *ctx, int fd, int zero)
+{
+  char *buf = malloc(XARGS_BUFSIZE), *item = NULL;
+  size_t len = 0, cap = 0;
+  int quote = 0, escape = 0, in_item = 0, c;
+  ssize_t n, i;
+
+  if (!buf) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  for (;;) {
+    n = read(fd, buf, XARGS_BUFSIZE);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      fprintf(stderr, "soshell: xargs: %s\n", strerror(errno));
+    }
+    if (n <= 0) {
+      break;
+    }
+    soshell_job_yield();
+    for (i = 0; i < n; i++) {
+      c = (unsigned char)buf[i];
+      if (zero) {
+        if (c == '\0') {
+          xargs_add(ctx, item ? item : "", len);
+          len = 0;
+          in_item = 0;
+          continue;
+        }
+        in_item = 1;
+      } else if (escape) {
+        escape = 0;
+      } else if (quote) {
+        if (c == quote) {
+          quote = 0;
+          continue;
+        }
+      } else if (c == '\\') {
+        escape = in_item = 1;
+        continue;
+      } else if (c == '\'' || c == '"') {
+        quote = c;
+        in_item = 1;
+        continue;
+      } else if (c == ' ' || c == '\t' || c == '\n') {
+        if (in_item) {
+          xargs_add(ctx, item ? item : "", len);
+          len = 0;
+          in_item = 0;
+        }
+        continue;
+      } else {
+        in_item = 1;
+      }
+      if (len + 1 > cap) {
+        cap = cap ? 2 * cap : 256;
+        item = realloc(item, cap);
+        if (!item) {
+          fprintf(stderr, "soshell: allocation error\n");
+          exit(EXIT_FAILURE);
+        }
+      }
+      item[len++] = c;
+    }
+  }
+  if (quote) {
+    fprintf(stderr, "soshell: xargs: unmatched %c quote\n", quote);
+  } else if (in_item) {
+    xargs_add(ctx, item ? item : "", len);
+  }
+  free(item);
+  free(buf);
+}
+
+/**
+   @brief Builtin command: build and run commands from standard input.
+   @param args List of args.  Options -0 (NUL separated items), -n max
+   (items per command), -P procs (commands at once, 0 for one per CPU),
+   then the command and its initial arguments; echo by default.
+   @return Always returns 1, to continue executing.
+ */
+int soshell_xargs(char **args)
+{
+  struct xargs_ctx ctx;
+  char *echo[] = { "echo", NULL };
+  char path[4096];
+  const char *val;
+  int i, opt, zero = 0;
+
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.nprocs = 1;
+  for (i = 1; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+    if (strcmp(args[i], "-0") == 0) {
+      zero = 1;
+      continue;
+    }
+    opt = args[i][1];
+    if (opt != 'n' && opt != 'P') {
+      fprintf(stderr, "soshell: xargs: unknown option %s\n", args[i]);
+      return 1;
+    }
+    val = args[i][2] ? args[i] + 2 : args[++i];
+    if (val == NULL) {
+      fprintf(stderr, "soshell: xargs: -%c needs a number\n", opt);
+      return 1;
+    }
+    if (opt == 'n') {
+      ctx.maxargs = atol(val);
+    } else {
+      ctx.nprocs = atoi(val);
+    }
+  }
+  if (ctx.nprocs <= 0) {
+    ctx.nprocs = soshell_ncpus();
+  }
+  if (ctx.nprocs > 64) {
+    ctx.nprocs = 64;
+  }
+
+  ctx.init = args[i] ? args + i : echo;
+  for (ctx.ninit = 0; ctx.init[ctx.ninit] != NULL; ctx.ninit++) {}
+  ctx.budget = xargs_budget(ctx.init, ctx.ninit);
+  if (ctx.budget <= 0) {
+    fprintf(stderr, "soshell: xargs: environment leaves no room for arguments\n");
+    return 1;
+  }
+  if (soshell_path_lookup(ctx.init[0], path, sizeof(path)) == 0) {
+    ctx.path = path;
+  }
+  ctx.out_fd = soshell_out_current()->fd;
+  ctx.pids = malloc(ctx.nprocs * sizeof(*ctx.pids));
+  ctx.pidfds = malloc(ctx.nprocs * sizeof(*ctx.pidfds));
+  if (!ctx.pids || !ctx.pidfds) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+
+  xargs_read(&ctx, soshell_in_fd, zero);
+  // Like other xargs, run the command once even without input.
+  if (ctx.nitems > 0 || !ctx.ran) {
+    xargs_run(&ctx);
+  }
+  while (ctx.nrunning > 0) {
+    xargs_wait_one(&ctx);
+  }
+  free(ctx.items);
+  free(ctx.pids);
+  free(ctx.pidfds);
+  return 1;
+}
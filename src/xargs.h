@@ -0,0 +1,6 @@
+#ifndef SOSHELL_XARGS_H
+#define SOSHELL_XARGS_H
+
+int soshell_xargs(char **args);
+
+#endif
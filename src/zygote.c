@@ -0,0 +1,382 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "zygote.h"
+#include "stats.h"
+#include "trace.h"
+
+/*
+  Fork server.  fork() copies the page tables of the whole shell, so the
+  cost of launching a command grows with the shell's heap.  The zygote
+  is a helper forked while the shell is still small; it receives spawn
+  requests over a socketpair and forks the commands itself, so their
+  cost stays that of a process of a few hundred kilobytes.
+
+  A request is a header sent with sendmsg() carrying, as SCM_RIGHTS,
+  the command's standard input, output and error and the shell's
+  current directory, followed by the executable path (empty to search
+  PATH), the arguments and the environment, all NUL terminated.  The
+  zygote answers twice: with the pid (or an errno) once the child is
+  forked, and with its wait status once it has exited.  Commands run
+  one at a time, as the shell waits for each.
+ */
+
+#define ZYGOTE_NFDS 4
+
+struct zygote_request {
+  uint32_t argc;
+  uint32_t envc;
+  uint32_t len;            /* bytes of strings that follow */
+};
+
+struct zygote_reply {
+  int32_t pid;             /* or -errno */
+  int32_t status;
+};
+
+extern char **environ;
+
+static int zygote_fd = -1;
+static pid_t zygote_pid;
+
+static int zygote_read_full(int fd, void *buf, size_t len)
+{
+  char *p = buf;
+  ssize_t n;
+
+  while (len > 0) {
+    n = read(fd, p, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/*
+  send() rather than write(): a peer that died must show as EPIPE, for
+  the shell to fork by itself, and not kill it with SIGPIPE.
+ */
+static int zygote_write_full(int fd, const void *buf, size_t len)
+{
+  const char *p = buf;
+  ssize_t n;
+
+  while (len > 0) {
+    n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/*
+  In the zygote's child: take over the shell's descriptors and
+  directory, then exec.
+ */
+static void zygote_exec(int *fds, char *path, char **argv, char **envp)
+{
+  sigset_t none;
+  int i;
+
+  signal(SIGINT, SIG_DFL);
+  signal(SIGQUIT, SIG_DFL);
+  sigemptyset(&none);
+  sigprocmask(SIG_SETMASK, &none, NULL);
+  if (fchdir(fds[3]) != 0) {
+    perror("soshell");
+  }
+  for (i = 0; i < 3; i++) {
+    if (fds[i] != i) {
+      dup2(fds[i], i);
+    }
+  }
+  for (i = 0; i < ZYGOTE_NFDS; i++) {
+    if (fds[i] > 2) {
+      close(fds[i]);
+    }
+  }
+  if (path[0] != '\0') {
+    execve(path, argv, envp);
+  }
+  execvpe(argv[0], argv, envp);
+  perror("soshell");
+  _exit(127);
+}
+
+/*
+  Receive one request, with its descriptors.  Returns -1 when the
+  shell has gone away.
+ */
+static int zygote_receive(int sock, struct zygote_request *req, int *fds, char **strings)
+{
+  char control[CMSG_SPACE(ZYGOTE_NFDS * sizeof(int))];
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+  ssize_t n;
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = req;
+  iov.iov_len = sizeof(*req);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  do {
+    n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+  if (n != sizeof(*req)) {
+    return -1;
+  }
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(ZYGOTE_NFDS * sizeof(int))) {
+    return -1;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), ZYGOTE_NFDS * sizeof(int));
+  *strings = malloc(req->len);
+  if (*strings == NULL || zygote_read_full(sock, *strings, req->len) < 0 ||
+      req->len == 0 || (*strings)[req->len - 1] != '\0') {
+    return -1;
+  }
+  return 0;
+}
+
+static void zygote_serve(int sock)
+{
+  struct zygote_request req;
+  struct zygote_reply reply;
+  char *strings, *p, **vec;
+  int fds[ZYGOTE_NFDS], i, status;
+  pid_t pid;
+
+  // Interrupts from the terminal are for the command, not the zygote.
+  signal(SIGINT, SIG_IGN);
+  signal(SIGQUIT, SIG_IGN);
+  prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+  while (zygote_receive(sock, &req, fds, &strings) == 0) {
+    vec = malloc((req.argc + req.envc + 2) * sizeof(char *));
+    if (vec == NULL) {
+      _exit(EXIT_FAILURE);
+    }
+    // The path comes first, then argv and envp.
+    p = strings + strlen(strings) + 1;
+    for (i = 0; i < (int)req.argc; i++) {
+      vec[i] = p;
+      p += strlen(p) + 1;
+    }
+    vec[req.argc] = NULL;
+    for (i = 0; i < (int)req.envc; i++) {
+      vec[req.argc + 1 + i] = p;
+      p += strlen(p) + 1;
+    }
+    vec[req.argc + 1 + req.envc] = NULL;
+
+    pid = fork();
+    if (pid == 0) {
+      close(sock);
+      zygote_exec(fds, strings, vec, vec + req.argc + 1);
+    }
+    for (i = 0; i < ZYGOTE_NFDS; i++) {
+      close(fds[i]);
+    }
+    free(vec);
+    free(strings);
+    reply.pid = (pid < 0) ? -errno : pid;
+    reply.status = 0;
+    if (zygote_write_full(sock, &reply, sizeof(reply)) < 0) {
+      _exit(EXIT_SUCCESS);
+    }
+    if (pid < 0) {
+      continue;
+    }
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    reply.status = status;
+    if (zygote_write_full(sock, &reply, sizeof(reply)) < 0) {
+      _exit(EXIT_SUCCESS);
+    }
+  }
+  _exit(EXIT_SUCCESS);
+}
+
+/**
+   @brief Start the fork server.  Call it early, while the shell's heap
+   is small: the zygote is a copy of the shell as it is now.
+   @return 0 on success, -1 if it could not be started.
+ */
+int soshell_zygote_start(void)
+{
+  int sv[2];
+  pid_t pid;
+
+  if (zygote_fd >= 0) {
+    return 0;
+  }
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+    perror("soshell: zygote");
+    return -1;
+  }
+  fflush(NULL);
+  pid = fork();
+  if (pid == 0) {
+    close(sv[0]);
+    zygote_serve(sv[1]);
+  }
+  close(sv[1]);
+  if (pid < 0) {
+    perror("soshell: zygote");
+    close(sv[0]);
+    return -1;
+  }
+  zygote_fd = sv[0];
+  zygote_pid = pid;
+  return 0;
+}
+
+/**
+   @brief Stop the fork server; commands are forked by the shell again.
+ */
+void soshell_zygote_stop(void)
+{
+  int status;
+
+  if (zygote_fd < 0) {
+    return;
+  }
+  close(zygote_fd);
+  zygote_fd = -1;
+  while (waitpid(zygote_pid, &status, 0) < 0 && errno == EINTR) {}
+}
+
+/*
+  The zygote is gone: stop using it, so commands are forked directly.
+ */
+static void zygote_lost(void)
+{
+  fprintf(stderr, "soshell: zygote exited, forking commands directly\n");
+  soshell_zygote_stop();
+}
+
+/**
+   @brief Run a command through the fork server and wait for it.
+   @param path Full path of the command, or NULL to search PATH.
+   @param args Null terminated list of arguments (including program).
+   @param status Receives the wait status.
+   @return 0 if the command was run, -1 if the fork server is not
+   running (or was lost), in which case the caller forks itself.
+ */
+int soshell_zygote_run(const char *path, char **args, int *status)
+{
+  struct zygote_request req;
+  struct zygote_reply reply;
+  char control[CMSG_SPACE(ZYGOTE_NFDS * sizeof(int))];
+  int fds[ZYGOTE_NFDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, -1 };
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+  char *strings, *p;
+  size_t len;
+  uint64_t spawn, t;
+  int i, sent;
+
+  if (zygote_fd < 0) {
+    return -1;
+  }
+  fds[3] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (fds[3] < 0) {
+    return -1;
+  }
+
+  memset(&req, 0, sizeof(req));
+  len = strlen(path ? path : "") + 1;
+  for (i = 0; args[i] != NULL; i++) {
+    len += strlen(args[i]) + 1;
+  }
+  req.argc = i;
+  for (i = 0; environ[i] != NULL; i++) {
+    len += strlen(environ[i]) + 1;
+  }
+  req.envc = i;
+  req.len = len;
+  strings = malloc(len);
+  if (!strings) {
+    fprintf(stderr, "soshell: allocation error\n");
+    exit(EXIT_FAILURE);
+  }
+  p = stpcpy(strings, path ? path : "") + 1;
+  for (i = 0; args[i] != NULL; i++) {
+    p = stpcpy(p, args[i]) + 1;
+  }
+  for (i = 0; environ[i] != NULL; i++) {
+    p = stpcpy(p, environ[i]) + 1;
+  }
+
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  iov.iov_base = &req;
+  iov.iov_len = sizeof(req);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  t = soshell_trace_begin();
+  spawn = soshell_stats_spawn_begin();
+  do {
+    sent = sendmsg(zygote_fd, &msg, MSG_NOSIGNAL);
+  } while (sent < 0 && errno == EINTR);
+  close(fds[3]);
+  if (sent != sizeof(req) || zygote_write_full(zygote_fd, strings, len) < 0 ||
+      zygote_read_full(zygote_fd, &reply, sizeof(reply)) < 0) {
+    free(strings);
+    zygote_lost();
+    return -1;
+  }
+  free(strings);
+  if (reply.pid < 0) {
+    fprintf(stderr, "soshell: %s\n", strerror(-reply.pid));
+    *status = 0;
+    return 0;
+  }
+  soshell_stats_spawn_end(spawn);
+  soshell_counters.forks++;
+  soshell_trace_end("spawn", args[0], t);
+
+  t = soshell_trace_begin();
+  if (zygote_read_full(zygote_fd, &reply, sizeof(reply)) < 0) {
+    // The command did start: it must not be run a second time.
+    zygote_lost();
+    reply.status = 0;
+  }
+  soshell_trace_end("wait", args[0], t);
+  *status = reply.status;
+  return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef SOSHELL_ZYGOTE_H
+#define SOSHELL_ZYGOTE_H
+
+int soshell_zygote_start(void);
+void soshell_zygote_stop(void);
+int soshell_zygote_run(const char *path, char **args, int *status);
+
+#endif